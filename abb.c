@@ -3,279 +3,2647 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #include "abb.h"
 #include "pila.h"
+#include "bitacora.h"
+#include "archivo.h"
+
+#define NINGUNO UINT32_MAX          // Índice nulo: no hay nodo / no hay clave
+#define NODOS_INICIAL 16            // Capacidad inicial del arreglo de nodos
+#define CLAVES_INICIAL 256          // Capacidad inicial del arreglo de claves (bytes)
+#define CLAVES_MAXIMO UINT32_MAX    // Los desplazamientos de las claves son de 32 bits (ver abb_guardar en abb.h)
+#define INDICE_INICIAL 64            // Capacidad inicial del índice de hash (potencia de 2)
+#define FILTRO_BLOQUE 64             // Bytes de cada bloque del filtro: una línea de caché
+#define FILTRO_CONTADORES (2 * FILTRO_BLOQUE) // Contadores de 4 bits por bloque
+#define FILTRO_SATURADO 15           // Un contador que llega acá ya no se decrementa
+#define VENCIMIENTOS_INICIAL 16      // Capacidad inicial de la cola de vencimientos
+#define ALINEACION 8                // Alineación de las claves y los datos en un ABB en archivo
+#define CLASES_EXACTAS 32           // Clases de espacios de claves de a ALINEACION bytes; las demás, potencias de 2
+#define CLASE_POTENCIA 512          // Tamaño de la primera clase que es potencia de 2
+#define PENDIENTE_MAXIMO (1 << 18)  // Bytes liberados en archivo a partir de los que conviene un punto de control
+#define RELOJ_BARRIDO 32            // Segundas oportunidades que da el reloj en cada desalojo
+#define RECLAMO_TANDA 4096          // Nodos que destruye el hilo de reclamo entre cada cesión del procesador
+#define PREFETCH_NIVELES 4          // Niveles del ABB congelado que se traen por adelantado al buscar
 
 /* *****************************************************************
  *            Definición de las estructuras de datos               *
  * *****************************************************************/
 
-typedef struct nodo_abb {
-	char *clave;
-	void *dato;
-	struct nodo_abb *izq;
-	struct nodo_abb *der;
-} abb_nodo_t;
+/* Los nodos viven en un único arreglo que crece y se enlazan entre sí por
+ * índices de 32 bits. Las claves se copian una detrás de la otra en un
+ * arreglo de bytes aparte, y el nodo guarda su desplazamiento. */
+typedef struct nodo_abb {
+	void *dato;
+	uint32_t clave;     // Desplazamiento en arbol->claves, NINGUNO si el nodo está libre
+	uint32_t largo;     // Largo de la clave, sin contar el '\0'
+	uint32_t izq;
+	uint32_t der;       // En un nodo libre, enlaza con el siguiente nodo libre
+} abb_nodo_t;
+
+/* Entrada de la cola de vencimientos. Es válida mientras el nodo siga vivo
+ * y tenga ese mismo instante de vencimiento */
+typedef struct vencimiento {
+	uint64_t instante;
+	uint32_t nodo;
+} vencimiento_t;
+
+/* Entrada del índice de hash. Guarda el hash para no comparar claves de más */
+typedef struct entrada_indice {
+	uint32_t hash;
+	uint32_t nodo;          // NINGUNO si la entrada está vacía
+} entrada_indice_t;
+
+/* Espacio del arreglo de claves de un ABB en archivo. Un espacio libre guarda
+ * en sus primeros bytes el siguiente de la lista de su clase */
+typedef struct extension {
+	uint32_t desde;
+	uint32_t clase;
+} extension_t;
+
+typedef struct abb{
+	abb_nodo_t *nodos;
+	size_t capacidad;           // Capacidad del arreglo de nodos
+	size_t usados;              // Nodos usados alguna vez (libres o no)
+	uint32_t libres;            // Primer nodo de la lista de libres
+	char *claves;
+	size_t claves_usado;
+	size_t claves_capacidad;
+	size_t claves_basura;       // Bytes de claves de nodos ya borrados
+	uint32_t raiz;
+	abb_comparar_clave_t cmp;
+	abb_destruir_dato_t destruir_dato;
+	size_t cantidad;
+	size_t bytes;                           // Memoria de los elementos: nodo y clave de cada uno
+	size_t max_cantidad;                    // Límites del modo caché, 0 si no hay límite
+	size_t max_bytes;
+	uint8_t *referencias;                   // Por nodo, si se usó desde la última pasada del reloj
+	uint32_t manecilla;                     // Próximo nodo que mira el reloj al desalojar
+	abb_agregado_t agregado;
+	int64_t *agregados;                     // Por nodo, el agregado de su subárbol, NULL si no hay
+	entrada_indice_t *indice;               // Índice de hash de las claves, NULL si no hay
+	size_t indice_capacidad;                // Potencia de 2, al menos el doble de la cantidad
+	uint8_t *filtro;                        // Filtro de Bloom con contadores, NULL si no hay
+	size_t filtro_bloques;
+	size_t filtro_capacidad;                // Claves para las que se dimensionó el filtro
+	size_t filtro_contadores;               // Contadores por clave, según la tasa de falsos positivos
+	unsigned filtro_funciones;              // Contadores que toca cada clave
+	uint64_t *vencimientos;                 // Por nodo, instante en ms en que vence, 0 si no vence
+	vencimiento_t *cola;                    // Heap de mínimos de vencimientos pendientes
+	size_t cola_cantidad;
+	size_t cola_capacidad;
+	bitacora_t *bitacora;                   // NULL si las modificaciones no se registran
+	abb_serializar_dato_t serializar;
+	abb_deserializar_dato_t deserializar;
+	size_t pasos_lote;                      // Nodos recorridos más operaciones de lote desde el último rebalanceo
+	struct abb *siguiente_diferido;         // En la cola de destrucciones diferidas
+	archivo_t *archivo;                     // NULL si el ABB vive en memoria
+	size_t tam_dato;                        // Bytes de cada dato en archivo
+	char *datos;                            // En archivo, los datos de cada nodo, según su número
+	uint32_t *epocas;                       // Por nodo, en qué época se creó. Solo en archivo
+	uint32_t epoca;                         // Épocas transcurridas: cada punto de control abre una
+	uint32_t *liberados;                    // Nodos que se liberan recién en el próximo punto de control
+	size_t liberados_cantidad;
+	size_t liberados_capacidad;
+	uint32_t *claves_libres;                // Por clase, lista de espacios de claves libres. Solo en archivo
+	extension_t *extensiones;               // Espacios de claves que se liberan en el próximo punto de control
+	size_t extensiones_cantidad;
+	size_t extensiones_capacidad;
+	size_t extensiones_bytes;
+	bool archivo_error;                     // Si alguna modificación en archivo no se pudo hacer
+} abb_t;
+
+/* Hilo que destruye en segundo plano los ABB de abb_destruir_diferido. Se
+ * crea con la primera destrucción diferida y termina en abb_esperar_destrucciones */
+typedef struct reclamo {
+	pthread_mutex_t mutex;
+	pthread_cond_t hay_trabajo;
+	pthread_cond_t terminado;
+	abb_t *primero;             // Cola de ABB a destruir, enlazada por siguiente_diferido
+	abb_t *ultimo;
+	size_t pendientes;          // ABB encolados más el que se está destruyendo
+	bool activo;                // Si el hilo fue creado y no se le pidió terminar
+	bool salir;
+	pthread_t hilo;
+} reclamo_t;
+
+static reclamo_t reclamo = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	NULL, NULL, 0, false, false, 0
+};
+
+/* La pila guarda el camino pendiente: el tope es el nodo actual y debajo
+ * quedan los ancestros que todavía no se visitaron. Guarda números de nodo
+ * y no punteros, porque el arreglo de nodos se mueve al agrandarlo */
+typedef struct abb_iter {
+	const abb_t *arbol;
+	pila_t *pila;
+	char *prefijo;              // NULL si se recorren todas las claves
+	size_t largo_prefijo;
+	size_t restantes;           // Claves que faltan entregar antes de llegar al límite
+} abb_iter_t;
+
+/* Los elementos se guardan en orden de Eytzinger: la raíz en la posición 1
+ * y los hijos de k en 2k y 2k+1. La posición 0 no se usa. Las claves se
+ * copian en ese mismo orden, así los primeros niveles quedan juntos. */
+typedef struct abb_congelado {
+    const char **claves;
+    void **datos;
+    char *texto;                // Bytes de todas las claves
+    size_t cantidad;
+    abb_comparar_clave_t cmp;
+} abb_congelado_t;
+
+/* *****************************************************************
+ *                    Funciones auxiliares                         *
+ * *****************************************************************/
+
+/* Devuelve la clave del nodo i */
+static const char *nodo_clave(const abb_t *arbol, uint32_t i)
+{
+    return arbol->claves + arbol->nodos[i].clave;
+}
+
+/* Redondea n hacia arriba al múltiplo de ALINEACION */
+static size_t alinear(size_t n)
+{
+    return (n + ALINEACION - 1) & ~(size_t) (ALINEACION - 1);
+}
+
+/* Devuelve la clase de tamaño del espacio que hace falta para bytes, que es
+ * múltiplo de ALINEACION. Las chicas van de a ALINEACION bytes y las grandes
+ * de a potencias de 2 */
+static size_t clase(size_t bytes)
+{
+    size_t c = CLASES_EXACTAS;
+
+    if (bytes <= CLASES_EXACTAS * ALINEACION) {
+        return bytes / ALINEACION - 1;
+    }
+    for (size_t largo = CLASE_POTENCIA; largo < bytes; largo *= 2) {
+        c++;
+    }
+    return c;
+}
+
+/* Devuelve los bytes de los espacios de la clase c */
+static size_t clase_largo(size_t c)
+{
+    return c < CLASES_EXACTAS ? (c + 1) * ALINEACION : (size_t) CLASE_POTENCIA << (c - CLASES_EXACTAS);
+}
+
+/* Devuelve los bytes que ocupa en el arreglo de claves la entrada de una
+ * clave de largo dado. En archivo se redondea a su clase para poder reusarla */
+static size_t entrada_largo(const abb_t *arbol, size_t largo)
+{
+    if (arbol->archivo) {
+        return clase_largo(clase(alinear(largo + 1)));
+    }
+    return largo + 1;
+}
+
+/* Devuelve los bytes que separan los datos de dos nodos consecutivos en archivo */
+static size_t dato_largo(const abb_t *arbol)
+{
+    return alinear(arbol->tam_dato);
+}
+
+/* Devuelve si dato apunta a los datos de un ABB en archivo, que se pueden
+ * mover al reservar lugar para más nodos */
+static bool en_datos(const abb_t *arbol, const void *dato)
+{
+    const char *p = dato;
+
+    return arbol->archivo && arbol->tam_dato && p >= arbol->datos
+           && p < arbol->datos + arbol->capacidad * dato_largo(arbol);
+}
+
+/* Devuelve los bytes que ocupa un elemento con clave de largo dado: su nodo,
+ * su clave y, en archivo, su dato */
+static size_t elemento_largo(const abb_t *arbol, size_t largo)
+{
+    return sizeof(abb_nodo_t) + entrada_largo(arbol, largo) + (arbol->archivo ? dato_largo(arbol) : 0);
+}
+
+/* Devuelve el dato del nodo. En archivo, apunta a sus bytes detrás de la clave */
+static void *nodo_dato(const abb_t *arbol, uint32_t i)
+{
+    const abb_nodo_t *nodo = &arbol->nodos[i];
+
+    if (arbol->archivo) {
+        return arbol->datos + (size_t) i * dato_largo(arbol);
+    }
+    return nodo->dato;
+}
+
+/* Devuelve el hash de la clave y su largo a través de largo. Es FNV-1a con
+ * una mezcla final para que todos los bits dependan de toda la clave */
+static uint64_t hash_clave(const char *clave, size_t *largo)
+{
+    uint64_t hash = 0xcbf29ce484222325u;
+    const char *c;
+
+    for (c = clave; *c; c++) {
+        hash = (hash ^ (unsigned char) *c) * 0x100000001b3u;
+    }
+    *largo = (size_t) (c - clave);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdu;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/* Ubica al nodo en el índice. Debe haber lugar */
+static void indice_insertar(abb_t *arbol, uint32_t nodo)
+{
+    size_t largo;
+    uint32_t hash = (uint32_t) hash_clave(nodo_clave(arbol, nodo), &largo);
+    size_t mascara = arbol->indice_capacidad - 1;
+    size_t pos = hash & mascara;
+
+    while (arbol->indice[pos].nodo != NINGUNO) {
+        pos = (pos + 1) & mascara;
+    }
+    arbol->indice[pos].hash = hash;
+    arbol->indice[pos].nodo = nodo;
+}
+
+/* Saca al nodo del índice. Corre hacia atrás las entradas siguientes que
+ * quedarían inalcanzables, para no tener que marcar entradas borradas */
+static void indice_sacar(abb_t *arbol, uint32_t nodo)
+{
+    size_t largo;
+    size_t mascara = arbol->indice_capacidad - 1;
+    size_t pos = (uint32_t) hash_clave(nodo_clave(arbol, nodo), &largo) & mascara;
+    size_t siguiente;
+
+    while (arbol->indice[pos].nodo != nodo) {
+        pos = (pos + 1) & mascara;
+    }
+    for (siguiente = (pos + 1) & mascara; arbol->indice[siguiente].nodo != NINGUNO; siguiente = (siguiente + 1) & mascara) {
+        size_t ideal = arbol->indice[siguiente].hash & mascara;
+        /* La entrada puede ocupar el hueco si su lugar ideal no está entre el hueco y ella */
+        if (((siguiente - ideal) & mascara) >= ((siguiente - pos) & mascara)) {
+            arbol->indice[pos] = arbol->indice[siguiente];
+            pos = siguiente;
+        }
+    }
+    arbol->indice[pos].nodo = NINGUNO;
+}
+
+/* Devuelve el nodo con la clave dada según el índice, o NINGUNO */
+static uint32_t indice_buscar(const abb_t *arbol, const char *clave)
+{
+    size_t largo;
+    uint32_t hash = (uint32_t) hash_clave(clave, &largo);
+    size_t mascara = arbol->indice_capacidad - 1;
+
+    for (size_t pos = hash & mascara; arbol->indice[pos].nodo != NINGUNO; pos = (pos + 1) & mascara) {
+        const abb_nodo_t *nodo = &arbol->nodos[arbol->indice[pos].nodo];
+        if (arbol->indice[pos].hash == hash && nodo->largo == largo
+            && memcmp(arbol->claves + nodo->clave, clave, largo) == 0) {
+            return arbol->indice[pos].nodo;
+        }
+    }
+    return NINGUNO;
+}
+
+/* Se asegura de que el índice, si existe, tenga lugar para n claves más sin
+ * pasar la mitad de ocupación. Si falla devuelve false */
+static bool indice_reservar(abb_t *arbol, size_t n)
+{
+    size_t capacidad = arbol->indice_capacidad;
+    entrada_indice_t *indice;
+
+    if (!arbol->indice || 2 * (arbol->cantidad + n) <= capacidad) {
+        return true;
+    }
+    while (2 * (arbol->cantidad + n) > capacidad) {
+        capacidad *= 2;
+    }
+    indice = malloc(capacidad * sizeof(entrada_indice_t));
+    if (!indice) {
+        return false;
+    }
+    for (size_t pos = 0; pos < capacidad; pos++) {
+        indice[pos].nodo = NINGUNO;
+    }
+    /* Vuelvo a ubicar las entradas con la máscara nueva; el hash ya está calculado */
+    for (size_t pos = 0; pos < arbol->indice_capacidad; pos++) {
+        entrada_indice_t entrada = arbol->indice[pos];
+        size_t nueva;
+        if (entrada.nodo == NINGUNO) {
+            continue;
+        }
+        for (nueva = entrada.hash & (capacidad - 1); indice[nueva].nodo != NINGUNO; nueva = (nueva + 1) & (capacidad - 1));
+        indice[nueva] = entrada;
+    }
+    free(arbol->indice);
+    arbol->indice = indice;
+    arbol->indice_capacidad = capacidad;
+    return true;
+}
+
+/* Devuelve el bloque del filtro que le toca al hash. Todos los contadores de
+ * una clave caen en el mismo bloque, así consultarla lee una sola línea de caché */
+static uint8_t *filtro_bloque(const abb_t *arbol, uint64_t hash)
+{
+    return arbol->filtro + (((hash >> 32) * arbol->filtro_bloques) >> 32) * FILTRO_BLOQUE;
+}
+
+/* Devuelve la posición del siguiente contador dentro del bloque y avanza la mezcla */
+static size_t filtro_posicion(uint64_t *mezcla)
+{
+    *mezcla = *mezcla * 0x9e3779b97f4a7c15u + 0x632be59bd9b4e019u;
+    return (size_t) (*mezcla >> 57);
+}
+
+/* Suma (con delta 1) o resta (con delta -1) la clave del nodo en el filtro.
+ * Los contadores saturados quedan fijos, así nunca se pierde una clave */
+static void filtro_modificar(abb_t *arbol, uint32_t nodo, int delta)
+{
+    size_t largo;
+    uint64_t hash = hash_clave(nodo_clave(arbol, nodo), &largo);
+    uint8_t *bloque = filtro_bloque(arbol, hash);
+    uint64_t mezcla = hash;
+
+    for (unsigned k = 0; k < arbol->filtro_funciones; k++) {
+        size_t pos = filtro_posicion(&mezcla);
+        unsigned corrimiento = (pos & 1) * 4;
+        unsigned contador = (bloque[pos >> 1] >> corrimiento) & 0xF;
+        if (contador == FILTRO_SATURADO || (delta < 0 && contador == 0)) {
+            continue;
+        }
+        contador = delta > 0 ? contador + 1 : contador - 1;
+        bloque[pos >> 1] = (uint8_t) ((bloque[pos >> 1] & ~(0xF << corrimiento)) | (contador << corrimiento));
+    }
+}
+
+/* Devuelve false si la clave seguro no está en el ABB */
+static bool filtro_puede_estar(const abb_t *arbol, const char *clave)
+{
+    size_t largo;
+    uint64_t hash = hash_clave(clave, &largo);
+    const uint8_t *bloque = filtro_bloque(arbol, hash);
+    uint64_t mezcla = hash;
+
+    for (unsigned k = 0; k < arbol->filtro_funciones; k++) {
+        size_t pos = filtro_posicion(&mezcla);
+        if (!((bloque[pos >> 1] >> ((pos & 1) * 4)) & 0xF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Pide memoria para un filtro de la cantidad de bloques dada, alineada a
+ * líneas de caché y en cero. Si falla devuelve NULL */
+static uint8_t *filtro_reservar(size_t bloques)
+{
+    void *filtro;
+
+    if (posix_memalign(&filtro, FILTRO_BLOQUE, bloques * FILTRO_BLOQUE) != 0) {
+        return NULL;
+    }
+    memset(filtro, 0, bloques * FILTRO_BLOQUE);
+    return filtro;
+}
+
+/* Reemplaza el filtro por uno dimensionado para capacidad claves con todas
+ * las claves del ABB. Si no hay memoria deja el que estaba y devuelve false */
+static bool filtro_construir(abb_t *arbol, size_t capacidad)
+{
+    size_t bloques = (capacidad * arbol->filtro_contadores + FILTRO_CONTADORES - 1) / FILTRO_CONTADORES;
+    uint8_t *filtro = filtro_reservar(bloques ? bloques : 1);
+
+    if (!filtro) {
+        return false;
+    }
+    free(arbol->filtro);
+    arbol->filtro = filtro;
+    arbol->filtro_bloques = bloques ? bloques : 1;
+    arbol->filtro_capacidad = capacidad;
+    for (size_t i = 0; i < arbol->usados; i++) {
+        if (arbol->nodos[i].clave != NINGUNO) {
+            filtro_modificar(arbol, (uint32_t) i, 1);
+        }
+    }
+    return true;
+}
+
+/* Si el ABB pasó la capacidad del filtro, lo rehace con el doble para que
+ * la tasa de falsos positivos no se degrade */
+static void filtro_mantener(abb_t *arbol)
+{
+    if (arbol->cantidad > arbol->filtro_capacidad) {
+        filtro_construir(arbol, 2 * arbol->cantidad);
+    }
+}
+
+/* Copia las claves de los nodos vivos a un arreglo nuevo de la capacidad
+ * dada, descartando las de los nodos borrados. Si falla devuelve false */
+static bool claves_compactar(abb_t *arbol, size_t capacidad)
+{
+    char *claves = malloc(capacidad);
+    size_t usado = 0;
+
+    if (!claves) {
+        return false;
+    }
+    for (size_t i = 0; i < arbol->usados; i++) {
+        abb_nodo_t *nodo = &arbol->nodos[i];
+        if (nodo->clave == NINGUNO) {
+            continue;
+        }
+        memcpy(claves + usado, arbol->claves + nodo->clave, nodo->largo + 1);
+        nodo->clave = (uint32_t) usado;
+        usado += nodo->largo + 1;
+    }
+    free(arbol->claves);
+    arbol->claves = claves;
+    arbol->claves_usado = usado;
+    arbol->claves_capacidad = capacidad;
+    arbol->claves_basura = 0;
+    return true;
+}
+
+/* Se asegura de que haya lugar para n nodos más sin usar la lista de libres.
+ * Si falla devuelve false */
+static bool reservar_nodos(abb_t *arbol, size_t n)
+{
+    size_t capacidad = arbol->capacidad ? arbol->capacidad : NODOS_INICIAL;
+    abb_nodo_t *nodos;
+
+    if (arbol->usados + n <= arbol->capacidad) {
+        return true;
+    }
+    while (capacidad < arbol->usados + n && capacidad < NINGUNO) {
+        capacidad *= 2;
+    }
+    if (capacidad > NINGUNO) {
+        capacidad = NINGUNO;
+    }
+    if (capacidad < arbol->usados + n) {
+        return false;
+    }
+    if (arbol->archivo) {
+        size_t bytes;
+        /* Primero los datos: si los nodos no crecen, sobra lugar de datos */
+        if (!archivo_agrandar_datos(arbol->archivo, capacidad * dato_largo(arbol))) {
+            return false;
+        }
+        arbol->datos = archivo_datos(arbol->archivo, &bytes);
+        if (!archivo_agrandar_nodos(arbol->archivo, capacidad * sizeof(abb_nodo_t))) {
+            return false;
+        }
+        nodos = archivo_nodos(arbol->archivo, &bytes);
+    } else {
+        nodos = realloc(arbol->nodos, capacidad * sizeof(abb_nodo_t));
+        if (!nodos) {
+            return false;
+        }
+    }
+    arbol->nodos = nodos;
+    if (arbol->referencias) {
+        uint8_t *referencias = realloc(arbol->referencias, capacidad);
+        if (!referencias) {
+            return false;
+        }
+        arbol->referencias = referencias;
+    }
+    if (arbol->vencimientos) {
+        uint64_t *vencimientos = realloc(arbol->vencimientos, capacidad * sizeof(uint64_t));
+        if (!vencimientos) {
+            return false;
+        }
+        arbol->vencimientos = vencimientos;
+    }
+    if (arbol->agregados) {
+        int64_t *agregados = realloc(arbol->agregados, capacidad * sizeof(int64_t));
+        if (!agregados) {
+            return false;
+        }
+        arbol->agregados = agregados;
+    }
+    if (arbol->epocas) {
+        uint32_t *epocas = realloc(arbol->epocas, capacidad * sizeof(uint32_t));
+        if (!epocas) {
+            return false;
+        }
+        arbol->epocas = epocas;
+    }
+    arbol->capacidad = capacidad;
+    return true;
+}
+
+/* Se asegura de que entren bytes más de claves. Si falla devuelve false */
+static bool reservar_claves(abb_t *arbol, size_t bytes)
+{
+    size_t necesario = arbol->claves_usado + bytes;
+    size_t capacidad;
+    char *claves;
+
+    if (necesario <= arbol->claves_capacidad) {
+        return true;
+    }
+    /* Si la mitad de lo usado es basura conviene compactar antes que crecer,
+     * y contra el máximo hay que compactar aunque sea poca. En archivo no: el
+     * último punto de control usa las claves donde están, y la basura se
+     * reusa por clases. Se reserva al final igual, por si no hay de la clase */
+    if (!arbol->archivo && (arbol->claves_basura >= arbol->claves_usado / 2 || necesario > CLAVES_MAXIMO)) {
+        necesario -= arbol->claves_basura;
+    }
+    capacidad = arbol->claves_capacidad ? arbol->claves_capacidad : CLAVES_INICIAL;
+    while (capacidad < necesario && capacidad < CLAVES_MAXIMO) {
+        capacidad *= 2;
+    }
+    if (capacidad > CLAVES_MAXIMO) {
+        capacidad = CLAVES_MAXIMO;
+    }
+    if (capacidad < necesario) {
+        return false;
+    }
+    if (arbol->archivo) {
+        if (!archivo_agrandar_claves(arbol->archivo, capacidad)) {
+            return false;
+        }
+        arbol->claves = archivo_claves(arbol->archivo, &arbol->claves_capacidad);
+        return true;
+    }
+    if (arbol->claves_basura) {
+        return claves_compactar(arbol, capacidad);
+    }
+    claves = realloc(arbol->claves, capacidad);
+    if (!claves) {
+        return false;
+    }
+    arbol->claves = claves;
+    arbol->claves_capacidad = capacidad;
+    return true;
+}
+
+/* Se asegura de que haya lugar para un nodo más y para una clave de largo
+ * dado, sin que nodo_crear tenga que pedir memoria. Si falla devuelve false */
+static bool reservar(abb_t *arbol, size_t largo)
+{
+    return (arbol->libres != NINGUNO || reservar_nodos(arbol, 1)) && reservar_claves(arbol, largo + 1)
+           && indice_reservar(arbol, 1);
+}
+
+/* Toma un nodo de la lista de libres o, si no hay, uno sin usar. Debe haber lugar */
+static uint32_t nodo_tomar(abb_t *arbol)
+{
+    uint32_t i;
+
+    if (arbol->libres != NINGUNO) {
+        i = arbol->libres;
+        arbol->libres = arbol->nodos[i].der;
+    } else {
+        i = (uint32_t) arbol->usados++;
+    }
+    if (arbol->epocas) {
+        arbol->epocas[i] = arbol->epoca;
+    }
+    return i;
+}
+
+/* Devuelve cuántos nodos puede hacer falta copiar, en archivo, para guardar o
+ * borrar la clave: los del camino hasta ella y, si está, los del camino hasta
+ * el máximo de su subárbol izquierdo, que es el que la reemplaza al borrarla.
+ * También cuenta el camino hasta el mínimo de su subárbol derecho: después
+ * de borrarla, las claves entre ella y su reemplazo pasan por ahí. Así la
+ * suma sobre varias operaciones alcanza para todas, aplicadas en cualquier
+ * orden: cada nodo viejo se copia una sola vez, y solo si está en alguno de
+ * esos caminos del ABB antes de aplicarlas */
+static size_t largo_camino(const abb_t *arbol, const char *clave)
+{
+    uint32_t i = arbol->raiz;
+    size_t largo = 0;
+
+    while (i != NINGUNO) {
+        int comparacion = arbol->cmp(clave, nodo_clave(arbol, i));
+        largo++;
+        if (comparacion == 0) {
+            for (uint32_t j = arbol->nodos[i].izq; j != NINGUNO; j = arbol->nodos[j].der) {
+                largo++;
+            }
+            for (uint32_t j = arbol->nodos[i].der; j != NINGUNO; j = arbol->nodos[j].izq) {
+                largo++;
+            }
+            break;
+        }
+        i = comparacion < 0 ? arbol->nodos[i].izq : arbol->nodos[i].der;
+    }
+    return largo;
+}
+
+/* Versión de reservar para un ABB en archivo: deja lugar para n nodos, entre
+ * nuevos y copias, para los que se liberan, para bytes de claves y para las
+ * entradas de claves que liberan las operaciones dadas. Si falla devuelve false */
+static bool reservar_archivo(abb_t *arbol, size_t n, size_t bytes, size_t operaciones)
+{
+    if (!reservar_nodos(arbol, n) || !reservar_claves(arbol, bytes)) {
+        return false;
+    }
+    if (arbol->liberados_cantidad + n > arbol->liberados_capacidad) {
+        size_t capacidad = 2 * (arbol->liberados_cantidad + n);
+        uint32_t *liberados = realloc(arbol->liberados, capacidad * sizeof(uint32_t));
+        if (!liberados) {
+            return false;
+        }
+        arbol->liberados = liberados;
+        arbol->liberados_capacidad = capacidad;
+    }
+    /* Cada guardar o borrar libera a lo sumo una entrada de claves */
+    if (arbol->extensiones_cantidad + operaciones > arbol->extensiones_capacidad) {
+        size_t capacidad = 2 * (arbol->extensiones_cantidad + operaciones);
+        extension_t *extensiones = realloc(arbol->extensiones, capacidad * sizeof(extension_t));
+        if (!extensiones) {
+            return false;
+        }
+        arbol->extensiones = extensiones;
+        arbol->extensiones_capacidad = capacidad;
+    }
+    return true;
+}
+
+/* Reserva, en archivo, lo necesario para guardar o borrar la clave, con bytes
+ * de claves. Si falla devuelve false */
+static bool reservar_camino(abb_t *arbol, const char *clave, size_t bytes)
+{
+    return reservar_archivo(arbol, largo_camino(arbol, clave) + 1, bytes, 1);
+}
+
+/* Pone el espacio de claves dado en la lista de su clase */
+static void extension_soltar(abb_t *arbol, uint32_t desde, size_t c)
+{
+    memcpy(arbol->claves + desde, &arbol->claves_libres[c], sizeof(uint32_t));
+    arbol->claves_libres[c] = desde;
+}
+
+/* Toma lugar para una entrada de bytes dados: en archivo, un espacio libre de
+ * su clase si hay, y si no, del final. Devuelve su desplazamiento. Debe
+ * haberse reservado lugar al final para la entrada */
+static uint32_t entrada_tomar(abb_t *arbol, size_t bytes)
+{
+    uint32_t desde = (uint32_t) arbol->claves_usado;
+
+    if (arbol->claves_libres && arbol->claves_libres[clase(bytes)] != NINGUNO) {
+        size_t c = clase(bytes);
+        desde = arbol->claves_libres[c];
+        memcpy(&arbol->claves_libres[c], arbol->claves + desde, sizeof(uint32_t));
+        arbol->claves_basura -= bytes;
+        return desde;
+    }
+    arbol->claves_usado += bytes;
+    return desde;
+}
+
+/* Libera la entrada de claves del nodo i, que está en archivo. No se puede
+ * reusar hasta el próximo punto de control, que es cuando se libera también
+ * el nodo: el último todavía puede usarla. Debe haberse reservado lugar */
+static void entrada_liberar(abb_t *arbol, uint32_t i)
+{
+    extension_t *extension = &arbol->extensiones[arbol->extensiones_cantidad++];
+    size_t bytes = entrada_largo(arbol, arbol->nodos[i].largo);
+
+    extension->desde = arbol->nodos[i].clave;
+    extension->clase = (uint32_t) clase(bytes);
+    arbol->extensiones_bytes += bytes;
+}
+
+/* Crea un nodo para el ABB. Copia la clave, y en archivo también el dato.
+ * Debe haberse llamado a reservar antes */
+static uint32_t nodo_crear(abb_t *arbol, const char *clave, size_t largo, void *dato)
+{
+    uint32_t i = nodo_tomar(arbol);
+    abb_nodo_t *nodo = &arbol->nodos[i];
+    uint32_t desde = entrada_tomar(arbol, entrada_largo(arbol, largo));
+
+    memcpy(arbol->claves + desde, clave, largo + 1);
+    if (arbol->archivo) {
+        if (arbol->tam_dato) {
+            memcpy(arbol->datos + (size_t) i * dato_largo(arbol), dato, arbol->tam_dato);
+        }
+        dato = NULL;
+    }
+    nodo->clave = desde;
+    nodo->largo = (uint32_t) largo;
+    arbol->bytes += elemento_largo(arbol, largo);
+    nodo->dato = dato;
+    nodo->izq = NINGUNO;
+    nodo->der = NINGUNO;
+    if (arbol->indice) {
+        indice_insertar(arbol, i);
+    }
+    if (arbol->filtro) {
+        filtro_modificar(arbol, i, 1);
+    }
+    return i;
+}
+
+/* Devuelve el nodo a la lista de libres. Su clave pasa a ser basura. En
+ * archivo debe haberse reservado lugar para el liberado */
+static void nodo_liberar(abb_t *arbol, uint32_t i)
+{
+    abb_nodo_t *nodo = &arbol->nodos[i];
+
+    if (arbol->indice) {
+        indice_sacar(arbol, i);
+    }
+    if (arbol->filtro) {
+        filtro_modificar(arbol, i, -1);
+    }
+    arbol->claves_basura += entrada_largo(arbol, nodo->largo);
+    arbol->bytes -= elemento_largo(arbol, nodo->largo);
+    if (arbol->archivo) {
+        /* El último punto de control puede usarlo, y el dato que devuelve
+         * abb_borrar apunta a su lugar: se libera en el próximo */
+        entrada_liberar(arbol, i);
+        arbol->liberados[arbol->liberados_cantidad++] = i;
+        return;
+    }
+    nodo->clave = NINGUNO;
+    nodo->dato = NULL;
+    nodo->izq = NINGUNO;
+    nodo->der = arbol->libres;
+    arbol->libres = i;
+}
+
+/* Devuelve un nodo que se puede modificar en lugar de i. En archivo, si i es
+ * de antes del último punto de control se copia (el punto de control lo sigue
+ * usando tal cual) y el original se libera en el próximo. Debe haberse
+ * reservado lugar para la copia y para el liberado */
+static uint32_t escribible(abb_t *arbol, uint32_t i)
+{
+    uint32_t copia;
+
+    if (!arbol->epocas || arbol->epocas[i] == arbol->epoca) {
+        return i;
+    }
+    copia = nodo_tomar(arbol);
+    arbol->nodos[copia] = arbol->nodos[i];
+    if (arbol->tam_dato) {
+        /* La clave se comparte con el original, que no cambia; el dato va con el número de nodo */
+        memcpy(nodo_dato(arbol, copia), nodo_dato(arbol, i), arbol->tam_dato);
+    }
+    arbol->liberados[arbol->liberados_cantidad++] = i;
+    return copia;
+}
+
+/* Cambia el hijo izquierdo de i. Devuelve el nodo que quedó en lugar de i */
+static uint32_t cambiar_izq(abb_t *arbol, uint32_t i, uint32_t izq)
+{
+    if (arbol->nodos[i].izq != izq) {
+        i = escribible(arbol, i);
+        arbol->nodos[i].izq = izq;
+    }
+    return i;
+}
+
+/* Cambia el hijo derecho de i. Devuelve el nodo que quedó en lugar de i */
+static uint32_t cambiar_der(abb_t *arbol, uint32_t i, uint32_t der)
+{
+    if (arbol->nodos[i].der != der) {
+        i = escribible(arbol, i);
+        arbol->nodos[i].der = der;
+    }
+    return i;
+}
+
+/* Escribe el dato nuevo del nodo i, que está en archivo y se puede modificar:
+ * su dato es solo suyo, y el último punto de control no lo usa */
+static void dato_reescribir(abb_t *arbol, uint32_t i, const void *dato)
+{
+    if (arbol->tam_dato) {
+        memcpy(nodo_dato(arbol, i), dato, arbol->tam_dato);
+    }
+}
+
+/* Escribe un punto de control del ABB en archivo. Si sale bien empieza una
+ * época nueva: lo anterior ya se puede modificar y los nodos y espacios de
+ * claves liberados desde el punto de control anterior vuelven a sus listas de
+ * libres. limpio indica que las listas de libres del encabezado son confiables */
+static bool punto_de_control(abb_t *arbol, bool limpio)
+{
+    archivo_encabezado_t encabezado;
+
+    encabezado.usados = arbol->usados;
+    encabezado.cantidad = arbol->cantidad;
+    encabezado.bytes = arbol->bytes;
+    encabezado.claves_usado = arbol->claves_usado;
+    encabezado.claves_basura = arbol->claves_basura;
+    encabezado.raiz = arbol->raiz;
+    encabezado.libres = arbol->libres;
+    encabezado.tam_dato = (uint32_t) arbol->tam_dato;
+    encabezado.limpio = limpio;
+    memcpy(encabezado.claves_libres, arbol->claves_libres, sizeof(encabezado.claves_libres));
+    if (!archivo_confirmar(arbol->archivo, &encabezado)) {
+        return false;
+    }
+    arbol->epoca++;
+    for (size_t k = 0; k < arbol->extensiones_cantidad; k++) {
+        extension_soltar(arbol, arbol->extensiones[k].desde, arbol->extensiones[k].clase);
+    }
+    arbol->extensiones_cantidad = 0;
+    arbol->extensiones_bytes = 0;
+    for (size_t k = 0; k < arbol->liberados_cantidad; k++) {
+        abb_nodo_t *nodo = &arbol->nodos[arbol->liberados[k]];
+        nodo->clave = NINGUNO;
+        nodo->dato = NULL;
+        nodo->izq = NINGUNO;
+        nodo->der = arbol->libres;
+        arbol->libres = arbol->liberados[k];
+    }
+    arbol->liberados_cantidad = 0;
+    return true;
+}
+
+/* En archivo, lo liberado no se reusa hasta el próximo punto de control. Si
+ * lo liberado desde el último ya es mucho, y más de lo que ocupa el ABB,
+ * escribe uno, para que el archivo no crezca sin límite aunque no se
+ * sincronice. Hay que llamarla antes de modificar */
+static void archivo_mantener(abb_t *arbol)
+{
+    size_t pendiente = arbol->liberados_cantidad * sizeof(abb_nodo_t) + arbol->extensiones_bytes;
+
+    if (pendiente >= PENDIENTE_MAXIMO && pendiente >= arbol->bytes) {
+        /* Si falla no se pierde nada: sigue valiendo el punto de control anterior */
+        punto_de_control(arbol, false);
+    }
+}
+
+/* Aplica destruir_dato al dato de todos los nodos vivos si es distinto de NULL */
+static void destruir_nodos(abb_t *arbol)
+{
+    if (!arbol->destruir_dato) {
+        return;
+    }
+    for (size_t i = 0; i < arbol->usados; i++) {
+        if (arbol->nodos[i].clave != NINGUNO) {
+            arbol->destruir_dato(arbol->nodos[i].dato);
+        }
+    }
+}
+
+/* Devuelve el agregado del subárbol i, o la identidad si está vacío */
+static int64_t agregado_subarbol(const abb_t *arbol, uint32_t i)
+{
+    return i == NINGUNO ? arbol->agregado.identidad : arbol->agregados[i];
+}
+
+/* Recalcula el agregado del subárbol i a partir del de sus hijos. Hay que
+ * llamarla cada vez que cambian los hijos o el dato de i, de abajo hacia arriba */
+static void agregado_actualizar(abb_t *arbol, uint32_t i)
+{
+    const abb_nodo_t *nodo = &arbol->nodos[i];
+    int64_t valor;
+
+    if (!arbol->agregados) {
+        return;
+    }
+    valor = arbol->agregado.valor(nodo->dato);
+    valor = arbol->agregado.combinar(agregado_subarbol(arbol, nodo->izq), valor);
+    arbol->agregados[i] = arbol->agregado.combinar(valor, agregado_subarbol(arbol, nodo->der));
+}
+
+/* Calcula los agregados de todo el subárbol i, de abajo hacia arriba */
+static void agregados_calcular(abb_t *arbol, uint32_t i)
+{
+    if (i == NINGUNO) {
+        return;
+    }
+    agregados_calcular(arbol, arbol->nodos[i].izq);
+    agregados_calcular(arbol, arbol->nodos[i].der);
+    agregado_actualizar(arbol, i);
+}
+
+/* Devuelve el nodo que tiene la clave igual a la clave dada, comparando con la función del árbol
+ * Si no lo encuentra devuelve NINGUNO */
+static uint32_t buscar_nodo(const abb_t *arbol, uint32_t i, const char *clave)
+{
+    while (i != NINGUNO) {
+        int comparacion = arbol->cmp(clave, nodo_clave(arbol, i));
+        if (comparacion == 0)
+            return i;
+        else if (comparacion < 0)
+            i = arbol->nodos[i].izq;
+        else
+            i = arbol->nodos[i].der;
+    }
+    return NINGUNO;
+}
+
+/* Devuelve el nodo con la clave dada, usando el filtro y el índice de hash si los hay */
+static uint32_t buscar(const abb_t *arbol, const char *clave)
+{
+    if (arbol->filtro && !filtro_puede_estar(arbol, clave))
+        return NINGUNO;
+    else if (arbol->indice)
+        return indice_buscar(arbol, clave);
+    else
+        return buscar_nodo(arbol, arbol->raiz, clave);
+}
+
+/* Inserta la clave en el subárbol i, o reemplaza su dato si ya estaba. Devuelve
+ * la nueva raíz del subárbol, y a través de nodo el que quedó con el dato.
+ * Debe haberse llamado a reservar antes */
+static uint32_t insertar_nodo(abb_t *arbol, uint32_t i, const char *clave, size_t largo, void *dato, uint32_t *nodo)
+{
+    int comparacion;
+
+    if (i == NINGUNO) {
+        ++(arbol->cantidad);
+        *nodo = nodo_crear(arbol, clave, largo, dato);
+        agregado_actualizar(arbol, *nodo);
+        return *nodo;
+    }
+    comparacion = arbol->cmp(clave, nodo_clave(arbol, i));
+    if (comparacion > 0) {
+        uint32_t der = insertar_nodo(arbol, arbol->nodos[i].der, clave, largo, dato, nodo);
+        i = cambiar_der(arbol, i, der);
+    } else if (comparacion < 0) {
+        uint32_t izq = insertar_nodo(arbol, arbol->nodos[i].izq, clave, largo, dato, nodo);
+        i = cambiar_izq(arbol, i, izq);
+    } else if (arbol->archivo) {
+        i = escribible(arbol, i);
+        *nodo = i;
+        dato_reescribir(arbol, i, dato);
+    } else {
+        /* La clave pertenece al ABB, reemplazo el dato */
+        void *aux = arbol->nodos[i].dato;
+        *nodo = i;
+        arbol->nodos[i].dato = dato;
+        if (arbol->destruir_dato) {
+            arbol->destruir_dato(aux);
+        }
+    }
+    agregado_actualizar(arbol, i);
+    return i;
+}
+
+/* Busca el nodo con la mayor clave en el subárbol dado, lo desengancha y lo
+ * devuelve a través de maximo. Devuelve la nueva raíz del subárbol */
+static uint32_t buscar_maximo(abb_t *arbol, uint32_t actual, uint32_t *maximo)
+{
+    if (arbol->nodos[actual].der != NINGUNO) {
+        /* No estoy en el máximo todavía */
+        uint32_t der = buscar_maximo(arbol, arbol->nodos[actual].der, maximo);
+        actual = cambiar_der(arbol, actual, der);
+        agregado_actualizar(arbol, actual);
+        return actual;
+    }
+    /* actual no tiene hijo derecho, es el máximo */
+    *maximo = actual;
+    return arbol->nodos[actual].izq;
+}
+
+/* Une dos subárboles, con todas las claves de izq menores a las de der, en uno
+ * solo. Devuelve la raíz del subárbol unido */
+static uint32_t unir(abb_t *arbol, uint32_t izq, uint32_t der)
+{
+    uint32_t reemplazo;
+    uint32_t reemplazo_izq;
+
+    if (izq == NINGUNO) {
+        /* Si no hay árbol izquierdo, queda el subárbol derecho */
+        return der;
+    }
+    /* Tomamos como raíz al máximo del subárbol izquierdo */
+    reemplazo_izq = buscar_maximo(arbol, izq, &reemplazo);
+    reemplazo = escribible(arbol, reemplazo);
+    arbol->nodos[reemplazo].izq = reemplazo_izq;
+    arbol->nodos[reemplazo].der = der;
+    agregado_actualizar(arbol, reemplazo);
+    return reemplazo;
+}
+
+/* Busca el nodo que debe borrar, lo desengancha y engancha el reemplazo con los hijos
+ * que tenía el nodo borrado. Devuelve el nodo borrado a través de nodo_salida */
+static uint32_t buscar_nodo_borrar(abb_t *arbol, uint32_t actual, const char *clave, uint32_t *nodo_salida)
+{
+    int comparacion;
+
+    if (actual == NINGUNO) {
+        *nodo_salida = NINGUNO;
+        return NINGUNO;
+    }
+    comparacion = arbol->cmp(clave, nodo_clave(arbol, actual));
+    if (comparacion < 0) {
+        uint32_t izq = buscar_nodo_borrar(arbol, arbol->nodos[actual].izq, clave, nodo_salida);
+        actual = cambiar_izq(arbol, actual, izq);
+        agregado_actualizar(arbol, actual);
+        return actual;
+    } else if (comparacion > 0) {
+        uint32_t der = buscar_nodo_borrar(arbol, arbol->nodos[actual].der, clave, nodo_salida);
+        actual = cambiar_der(arbol, actual, der);
+        agregado_actualizar(arbol, actual);
+        return actual;
+    } else {
+        /* clave == clave de actual, actual es el nodo a borrar */
+        *nodo_salida = actual;
+        return unir(arbol, arbol->nodos[actual].izq, arbol->nodos[actual].der);
+    }
+}
+
+/* Recorre los nodos en in-order recursivamente, comunicando con el valor de retorno en cada llamado si debe seguir la recursión */
+static bool abb_nodo_in_order(abb_t *arbol, uint32_t i, bool visitar(const char *, void *, void *), void *extra)
+{
+    if (i == NINGUNO)
+        return true; // Recorrió todo, porque no hay nada para recorrer
+    else if (!abb_nodo_in_order(arbol, arbol->nodos[i].izq, visitar, extra))
+        return false; // Si el subárbol izquierdo recibió false, devuelve false
+    else if (!visitar(nodo_clave(arbol, i), nodo_dato(arbol, i), extra))
+        return false; // Visita el nodo actual, comunica a las llamadas previas que deben terminar
+    else if (!abb_nodo_in_order(arbol, arbol->nodos[i].der, visitar, extra))
+        return false; // Si el subárbol derecho recibió false, devuelve false
+    else
+        return true;
+}
+
+/* Apila el número de nodo dado en la pila del iterador */
+static void apilar_nodo(pila_t *pila, uint32_t i)
+{
+    pila_apilar(pila, (void *) (uintptr_t) i);
+}
+
+/* Devuelve el número de nodo del tope de la pila del iterador */
+static uint32_t tope_nodo(const pila_t *pila)
+{
+    return (uint32_t) (uintptr_t) pila_ver_tope(pila);
+}
+
+/* Apila el nodo dado y todos sus descendientes por la izquierda: el último
+ * apilado es el menor del subárbol */
+static void apilar_izquierdos(pila_t *pila, const abb_t *arbol, uint32_t i)
+{
+    while (i != NINGUNO) {
+        apilar_nodo(pila, i);
+        i = arbol->nodos[i].izq;
+    }
+}
+
+/* Apila el camino hasta la menor clave mayor o igual a la dada: en el tope
+ * queda esa clave y debajo los ancestros mayores, en in-order */
+static void apilar_desde(pila_t *pila, const abb_t *arbol, const char *clave)
+{
+    uint32_t i = arbol->raiz;
+
+    while (i != NINGUNO) {
+        if (arbol->cmp(nodo_clave(arbol, i), clave) >= 0) {
+            apilar_nodo(pila, i);
+            i = arbol->nodos[i].izq;
+        } else {
+            i = arbol->nodos[i].der;
+        }
+    }
+}
+
+/* Cuenta las claves del subárbol que empiezan con el prefijo dado. Solo baja
+ * por las ramas que pueden tener claves del prefijo */
+static size_t contar_prefijo(const abb_t *arbol, uint32_t i, const char *prefijo, size_t largo)
+{
+    size_t cantidad = 0;
+
+    while (i != NINGUNO) {
+        const char *clave = nodo_clave(arbol, i);
+        int comparacion = strncmp(clave, prefijo, largo);
+
+        if (comparacion < 0) {
+            i = arbol->nodos[i].der;
+        } else if (comparacion > 0) {
+            i = arbol->nodos[i].izq;
+        } else {
+            /* Empieza con el prefijo: puede haber más de ambos lados */
+            cantidad += 1 + contar_prefijo(arbol, arbol->nodos[i].izq, prefijo, largo);
+            i = arbol->nodos[i].der;
+        }
+    }
+    return cantidad;
+}
+
+/* Guarda en orden los índices de los nodos del subárbol a partir de orden[*n] */
+static void volcar_nodos(const abb_t *arbol, uint32_t i, uint32_t *orden, size_t *n)
+{
+    if (i == NINGUNO) {
+        return;
+    }
+    volcar_nodos(arbol, arbol->nodos[i].izq, orden, n);
+    orden[(*n)++] = i;
+    volcar_nodos(arbol, arbol->nodos[i].der, orden, n);
+}
+
+/* Recorre las posiciones de Eytzinger en in-order asignándoles los nodos
+ * ordenados. Las claves quedan apuntando a las del ABB */
+static void congelado_ubicar(abb_congelado_t *congelado, const abb_t *arbol, const uint32_t *orden, size_t k, size_t *i)
+{
+    if (k > congelado->cantidad) {
+        return;
+    }
+    congelado_ubicar(congelado, arbol, orden, 2 * k, i);
+    congelado->claves[k] = nodo_clave(arbol, orden[*i]);
+    congelado->datos[k] = nodo_dato(arbol, orden[*i]);
+    (*i)++;
+    congelado_ubicar(congelado, arbol, orden, 2 * k + 1, i);
+}
+
+/* Devuelve la posición de la menor clave mayor o igual a la dada, o 0 si no hay.
+ * El descenso no tiene saltos condicionales: el resultado de la comparación
+ * elige el hijo, y al final se deshacen los pasos a la derecha */
+static size_t congelado_cota_inferior(const abb_congelado_t *congelado, const char *clave)
+{
+    size_t k = 1;
+
+    while (k <= congelado->cantidad) {
+        __builtin_prefetch(congelado->claves + (k << PREFETCH_NIVELES));
+        k = 2 * k + (congelado->cmp(congelado->claves[k], clave) < 0);
+    }
+    /* Los unos finales de k son los pasos a la derecha dados después del
+     * último paso a la izquierda, que es donde quedó la cota */
+    return k >> (__builtin_ctzl(~k) + 1);
+}
+
+/* Devuelve la posición de la menor clave, o 0 si no hay elementos */
+static size_t congelado_primero(const abb_congelado_t *congelado)
+{
+    size_t k = 1;
+
+    if (!congelado->cantidad) {
+        return 0;
+    }
+    while (2 * k <= congelado->cantidad) {
+        k *= 2;
+    }
+    return k;
+}
+
+/* Devuelve la posición que le sigue a k en in-order, o 0 si k es la última */
+static size_t congelado_siguiente(const abb_congelado_t *congelado, size_t k)
+{
+    if (2 * k + 1 <= congelado->cantidad) {
+        /* Bajo al hijo derecho y luego todo a la izquierda */
+        k = 2 * k + 1;
+        while (2 * k <= congelado->cantidad) {
+            k *= 2;
+        }
+        return k;
+    }
+    /* Subo mientras sea hijo derecho, y una vez más */
+    while (k & 1) {
+        k >>= 1;
+    }
+    return k >> 1;
+}
+
+/* Devuelve el instante actual en milisegundos, de un reloj que no retrocede */
+static uint64_t ahora_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+/* Devuelve true si el nodo tiene vencimiento y ya venció */
+static bool nodo_vencido(const abb_t *arbol, uint32_t i)
+{
+    return arbol->vencimientos && arbol->vencimientos[i] && arbol->vencimientos[i] <= ahora_ms();
+}
+
+/* Devuelve el instante actual en milisegundos del reloj de pared, que a
+ * diferencia de ahora_ms sigue valiendo en otra ejecución */
+static uint64_t pared_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+/* Pasa un vencimiento al reloj de pared, para la bitácora. 0 sigue siendo
+ * que no vence */
+static uint64_t vencimiento_pared(uint64_t vencimiento)
+{
+    return vencimiento ? vencimiento - ahora_ms() + pared_ms() : 0;
+}
+
+/* Escribe en la imagen de la bitácora un registro de guardar por cada
+ * elemento que todavía no venció, con su vencimiento */
+static bool volcar_bitacora(bitacora_t *imagen, void *extra)
+{
+    abb_t *arbol = extra;
+
+    for (size_t i = 0; i < arbol->usados; i++) {
+        if (arbol->nodos[i].clave == NINGUNO || nodo_vencido(arbol, (uint32_t) i)) {
+            continue;
+        }
+        if (!bitacora_registrar(imagen, BITACORA_GUARDAR, nodo_clave(arbol, (uint32_t) i),
+                                arbol->vencimientos ? vencimiento_pared(arbol->vencimientos[i]) : 0,
+                                arbol->nodos[i].dato, arbol->serializar)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Compacta la bitácora si creció demasiado. Debe llamarse después de aplicar
+ * la modificación al ABB, para que la imagen la incluya */
+static void bitacora_mantener(abb_t *arbol)
+{
+    if (bitacora_debe_compactar(arbol->bitacora)) {
+        /* Si falla se sigue usando el archivo viejo, que también es válido */
+        bitacora_compactar(arbol->bitacora, volcar_bitacora, arbol);
+    }
+}
+
+/* Devuelve true si la entrada de la cola todavía corresponde a su nodo */
+static bool vencimiento_valido(const abb_t *arbol, vencimiento_t vencimiento)
+{
+    return arbol->nodos[vencimiento.nodo].clave != NINGUNO
+           && arbol->vencimientos[vencimiento.nodo] == vencimiento.instante;
+}
+
+/* Reubica hacia abajo la entrada de la posición dada del heap */
+static void cola_bajar(vencimiento_t *cola, size_t cantidad, size_t pos)
+{
+    while (2 * pos + 1 < cantidad) {
+        size_t hijo = 2 * pos + 1;
+        vencimiento_t aux;
+
+        if (hijo + 1 < cantidad && cola[hijo + 1].instante < cola[hijo].instante) {
+            hijo++;
+        }
+        if (cola[pos].instante <= cola[hijo].instante) {
+            return;
+        }
+        aux = cola[pos];
+        cola[pos] = cola[hijo];
+        cola[hijo] = aux;
+        pos = hijo;
+    }
+}
+
+/* Encola el vencimiento. Debe haberse llamado a reservar_vencimientos antes */
+static void cola_encolar(abb_t *arbol, uint64_t instante, uint32_t nodo)
+{
+    vencimiento_t *cola = arbol->cola;
+    size_t pos = arbol->cola_cantidad++;
+
+    cola[pos].instante = instante;
+    cola[pos].nodo = nodo;
+    while (pos > 0 && cola[(pos - 1) / 2].instante > cola[pos].instante) {
+        vencimiento_t aux = cola[pos];
+        cola[pos] = cola[(pos - 1) / 2];
+        cola[(pos - 1) / 2] = aux;
+        pos = (pos - 1) / 2;
+    }
+}
+
+/* Se asegura de que existan los vencimientos por nodo y de que haya lugar en
+ * la cola para uno más. Si la cola tiene más entradas viejas que válidas, la
+ * reconstruye con las válidas antes de crecer. Si falla devuelve false */
+static bool reservar_vencimientos(abb_t *arbol)
+{
+    if (!arbol->vencimientos) {
+        arbol->vencimientos = calloc(arbol->capacidad ? arbol->capacidad : 1, sizeof(uint64_t));
+        if (!arbol->vencimientos) {
+            return false;
+        }
+    }
+    if (arbol->cola_cantidad < arbol->cola_capacidad) {
+        return true;
+    }
+    if (arbol->cola_cantidad > 2 * arbol->cantidad) {
+        size_t n = 0;
+        for (size_t i = 0; i < arbol->cola_cantidad; i++) {
+            if (vencimiento_valido(arbol, arbol->cola[i])) {
+                arbol->cola[n++] = arbol->cola[i];
+            }
+        }
+        arbol->cola_cantidad = n;
+        for (size_t i = n / 2; i-- > 0; ) {
+            cola_bajar(arbol->cola, n, i);
+        }
+        if (n < arbol->cola_capacidad) {
+            return true;
+        }
+    }
+    size_t capacidad = arbol->cola_capacidad ? 2 * arbol->cola_capacidad : VENCIMIENTOS_INICIAL;
+    vencimiento_t *cola = realloc(arbol->cola, capacidad * sizeof(vencimiento_t));
+    if (!cola) {
+        return false;
+    }
+    arbol->cola = cola;
+    arbol->cola_capacidad = capacidad;
+    return true;
+}
+
+/* Saca del ABB el nodo con la clave dada y registra el borrado. Devuelve false
+ * si la clave no pertenece; si no, devuelve el dato a través de dato y si el
+ * elemento estaba vencido a través de vencido. En archivo, si no hay lugar
+ * para las copias no la saca, devuelve false y queda marcado el error */
+static bool quitar(abb_t *arbol, const char *clave, void **dato, bool *vencido)
+{
+    uint32_t borrado;
+
+    if (arbol->archivo) {
+        archivo_mantener(arbol);
+        if (!reservar_camino(arbol, clave, 0)) {
+            /* Si la clave no está no hacía falta lugar: no es un error */
+            if (buscar_nodo(arbol, arbol->raiz, clave) != NINGUNO) {
+                arbol->archivo_error = true;
+            }
+            return false;
+        }
+    }
+    arbol->raiz = buscar_nodo_borrar(arbol, arbol->raiz, clave, &borrado);
+    if (borrado == NINGUNO) {
+        return false;
+    }
+    *dato = nodo_dato(arbol, borrado);
+    *vencido = nodo_vencido(arbol, borrado);
+    --(arbol->cantidad);
+    nodo_liberar(arbol, borrado);
+    if (arbol->bitacora) {
+        /* Un error queda guardado en la bitácora y lo informa abb_bitacora_sincronizar */
+        bitacora_registrar(arbol->bitacora, BITACORA_BORRAR, clave, 0, NULL, NULL);
+        bitacora_mantener(arbol);
+    }
+    return true;
+}
+
+/* Enlaza los nodos orden[desde, hasta), que están en in-order, como un
+ * subárbol balanceado. Devuelve su raíz */
+static uint32_t enlazar_balanceado(abb_t *arbol, const uint32_t *orden, size_t desde, size_t hasta)
+{
+    size_t medio = desde + (hasta - desde) / 2;
+    uint32_t raiz, izq, der;
+
+    if (desde == hasta) {
+        return NINGUNO;
+    }
+    raiz = orden[medio];
+    izq = enlazar_balanceado(arbol, orden, desde, medio);
+    der = enlazar_balanceado(arbol, orden, medio + 1, hasta);
+    arbol->nodos[raiz].izq = izq;
+    arbol->nodos[raiz].der = der;
+    agregado_actualizar(arbol, raiz);
+    return raiz;
+}
+
+/* Vuelve a enlazar todo el ABB balanceado, sin comparar claves. Si no hay
+ * memoria para hacerlo el ABB queda como estaba */
+static void rebalancear(abb_t *arbol)
+{
+    uint32_t *orden = malloc((arbol->cantidad + 1) * sizeof(uint32_t));
+    size_t n = 0;
+
+    if (!orden) {
+        return;
+    }
+    volcar_nodos(arbol, arbol->raiz, orden, &n);
+    arbol->raiz = enlazar_balanceado(arbol, orden, 0, n);
+    free(orden);
+}
+
+/* Estado de la aplicación de un lote de operaciones. guardados[k] es la
+ * cantidad de operaciones de guardar entre las primeras k, y a la j-ésima
+ * operación de guardar le corresponde la posición indices[j] del lote */
+typedef struct lote {
+    abb_operacion_t *operaciones;
+    const size_t *guardados;
+    const size_t *indices;
+    size_t altura;              // Mayor profundidad alcanzada por un nodo tocado
+    size_t recorridos;          // Nodos del ABB por los que se bajó
+} lote_t;
+
+/* Crea los nodos de las operaciones de guardar indices[desde, hasta), en orden,
+ * como un subárbol balanceado que queda a la profundidad dada. Devuelve su raíz.
+ * Debe haberse reservado lugar para los nodos y las claves antes */
+static uint32_t lote_construir(abb_t *arbol, lote_t *lote, size_t desde, size_t hasta, size_t profundidad)
+{
+    size_t medio = desde + (hasta - desde) / 2;
+    abb_operacion_t *operacion;
+    uint32_t raiz, izq, der;
+
+    if (desde == hasta) {
+        return NINGUNO;
+    }
+    if (profundidad > lote->altura) {
+        lote->altura = profundidad;
+    }
+    operacion = &lote->operaciones[lote->indices[medio]];
+    raiz = nodo_crear(arbol, operacion->clave, strlen(operacion->clave), operacion->dato);
+    ++(arbol->cantidad);
+    if (arbol->referencias) {
+        arbol->referencias[raiz] = 1;
+    }
+    if (arbol->vencimientos) {
+        arbol->vencimientos[raiz] = 0;
+    }
+    izq = lote_construir(arbol, lote, desde, medio, profundidad + 1);
+    der = lote_construir(arbol, lote, medio + 1, hasta, profundidad + 1);
+    arbol->nodos[raiz].izq = izq;
+    arbol->nodos[raiz].der = der;
+    agregado_actualizar(arbol, raiz);
+    return raiz;
+}
+
+/* Aplica las operaciones [desde, hasta) del lote al subárbol i, que está a la
+ * profundidad dada. Las operaciones se reparten entre los dos hijos con una
+ * búsqueda binaria contra la clave de i, así a cada nodo del camino se le
+ * hacen a lo sumo log2 de sus operaciones comparaciones por lote y no una
+ * por operación. Devuelve la nueva raíz */
+static uint32_t lote_aplicar(abb_t *arbol, lote_t *lote, uint32_t i, size_t desde, size_t hasta, size_t profundidad)
+{
+    abb_operacion_t *operaciones = lote->operaciones;
+    size_t bajo = desde, alto = hasta;
+    uint32_t izq, der;
+    bool igual = false;
+
+    if (desde == hasta) {
+        return i;
+    }
+    if (i == NINGUNO) {
+        /* Las claves a guardar que caen acá son todas nuevas */
+        return lote_construir(arbol, lote, lote->guardados[desde], lote->guardados[hasta], profundidad);
+    }
+    if (profundidad > lote->altura) {
+        lote->altura = profundidad;
+    }
+    lote->recorridos++;
+    /* bajo queda en la primera operación con clave mayor o igual a la de i.
+     * Como no hay claves repetidas, la igual se puede cortar al encontrarla */
+    while (bajo < alto) {
+        size_t medio = bajo + (alto - bajo) / 2;
+        int comparacion = arbol->cmp(operaciones[medio].clave, nodo_clave(arbol, i));
+        if (comparacion < 0) {
+            bajo = medio + 1;
+        } else if (comparacion > 0) {
+            alto = medio;
+        } else {
+            bajo = medio;
+            igual = true;
+            break;
+        }
+    }
+    izq = lote_aplicar(arbol, lote, arbol->nodos[i].izq, desde, bajo, profundidad + 1);
+    der = lote_aplicar(arbol, lote, arbol->nodos[i].der, igual ? bajo + 1 : bajo, hasta, profundidad + 1);
+    arbol->nodos[i].izq = izq;
+    arbol->nodos[i].der = der;
+    if (!igual) {
+        agregado_actualizar(arbol, i);
+        return i;
+    }
+
+    if (operaciones[bajo].tipo == ABB_GUARDAR) {
+        /* La clave pertenece al ABB, reemplazo el dato */
+        void *aux = arbol->nodos[i].dato;
+        arbol->nodos[i].dato = operaciones[bajo].dato;
+        if (arbol->destruir_dato) {
+            arbol->destruir_dato(aux);
+        }
+        if (arbol->referencias) {
+            arbol->referencias[i] = 1;
+        }
+        if (arbol->vencimientos) {
+            arbol->vencimientos[i] = 0;
+        }
+        agregado_actualizar(arbol, i);
+        return i;
+    }
+    /* Borro i; si estaba vencido, para el usuario ya no estaba */
+    operaciones[bajo].dato = arbol->nodos[i].dato;
+    if (nodo_vencido(arbol, i)) {
+        if (arbol->destruir_dato) {
+            arbol->destruir_dato(operaciones[bajo].dato);
+        }
+        operaciones[bajo].dato = NULL;
+    }
+    --(arbol->cantidad);
+    nodo_liberar(arbol, i);
+    return unir(arbol, izq, der);
+}
+
+/* Devuelve la altura máxima que se tolera antes de rebalancear el ABB: unas
+ * 4 * log2(n). Un ABB de claves al azar anda por 3 * log2(n) y no gana nada
+ * con rebalancearse; lo que hay que corregir son los ABB degenerados */
+static size_t altura_tolerada(size_t cantidad)
+{
+    size_t altura = 2;
+
+    while (cantidad) {
+        altura += 4;
+        cantidad >>= 1;
+    }
+    return altura;
+}
+
+/* Devuelve true si el ABB superó alguno de los límites del modo caché */
+static bool excede_limites(const abb_t *arbol)
+{
+    return (arbol->max_cantidad && arbol->cantidad > arbol->max_cantidad)
+           || (arbol->max_bytes && arbol->bytes > arbol->max_bytes);
+}
+
+/* Marca al nodo como usado. Pueden llamarla varios lectores a la vez: la
+ * marca se escribe atómicamente, y solo si hace falta, para no invalidar la
+ * línea de caché en los demás núcleos */
+static void marcar_usado(const abb_t *arbol, uint32_t i)
+{
+    if (arbol->referencias && !__atomic_load_n(&arbol->referencias[i], __ATOMIC_RELAXED)) {
+        __atomic_store_n(&arbol->referencias[i], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Desaloja elementos hasta volver a estar dentro de los límites, sin tocar al
+ * nodo protegido. Usa el algoritmo del reloj: la manecilla recorre los nodos,
+ * a los usados desde la pasada anterior les da otra oportunidad y desaloja
+ * al primero que no se usó. Es una aproximación de LRU que no obliga a
+ * abb_obtener a reordenar nada: solo marca al nodo. Para que un desalojo no
+ * tenga que dar la vuelta entera cuando todos están marcados, después de
+ * RELOJ_BARRIDO oportunidades desaloja al siguiente aunque esté marcado */
+static void desalojar(abb_t *arbol, uint32_t protegido)
+{
+    size_t oportunidades = 0;
+
+    while (excede_limites(arbol) && arbol->cantidad > 1) {
+        uint32_t i = arbol->manecilla;
+
+        arbol->manecilla = (uint32_t) ((i + 1) % arbol->usados);
+        if (arbol->nodos[i].clave == NINGUNO || i == protegido) {
+            continue;
+        }
+        if (arbol->referencias[i] && oportunidades < RELOJ_BARRIDO) {
+            arbol->referencias[i] = 0;
+            oportunidades++;
+            continue;
+        }
+        oportunidades = 0;
+        /* La clave del nodo sigue siendo válida después de borrarlo */
+        void *dato;
+        bool vencido;
+        quitar(arbol, nodo_clave(arbol, i), &dato, &vencido);
+        if (arbol->destruir_dato) {
+            arbol->destruir_dato(dato);
+        }
+    }
+}
+
+/* *****************************************************************
+ *                    Primitivas del ABB                           *
+ * *****************************************************************/
+
+abb_t *abb_crear(abb_comparar_clave_t cmp, abb_destruir_dato_t destruir_dato)
+{
+	abb_t *arbol = malloc(sizeof(abb_t));
+
+	if (!arbol) {
+        return NULL;
+    }
+    arbol->nodos = NULL;
+    arbol->capacidad = 0;
+    arbol->usados = 0;
+    arbol->libres = NINGUNO;
+    arbol->claves = NULL;
+    arbol->claves_usado = 0;
+    arbol->claves_capacidad = 0;
+    arbol->claves_basura = 0;
+	arbol->raiz = NINGUNO;
+	arbol->cantidad = 0;
+	arbol->cmp = cmp;
+	arbol->destruir_dato = destruir_dato;
+	arbol->bytes = 0;
+	arbol->max_cantidad = 0;
+	arbol->max_bytes = 0;
+	arbol->referencias = NULL;
+	arbol->manecilla = 0;
+	arbol->agregados = NULL;
+	arbol->indice = NULL;
+	arbol->indice_capacidad = 0;
+	arbol->filtro = NULL;
+	arbol->filtro_bloques = 0;
+	arbol->filtro_capacidad = 0;
+	arbol->filtro_contadores = 0;
+	arbol->filtro_funciones = 0;
+	arbol->vencimientos = NULL;
+	arbol->cola = NULL;
+	arbol->cola_cantidad = 0;
+	arbol->cola_capacidad = 0;
+	arbol->bitacora = NULL;
+	arbol->serializar = NULL;
+	arbol->deserializar = NULL;
+	arbol->pasos_lote = 0;
+	arbol->siguiente_diferido = NULL;
+	arbol->archivo = NULL;
+	arbol->tam_dato = 0;
+	arbol->epocas = NULL;
+	arbol->datos = NULL;
+	arbol->epoca = 0;
+	arbol->liberados = NULL;
+	arbol->liberados_cantidad = 0;
+	arbol->liberados_capacidad = 0;
+	arbol->claves_libres = NULL;
+	arbol->extensiones = NULL;
+	arbol->extensiones_cantidad = 0;
+	arbol->extensiones_capacidad = 0;
+	arbol->extensiones_bytes = 0;
+	arbol->archivo_error = false;
+	return arbol;
+}
+
+abb_t *abb_crear_cache(abb_comparar_clave_t cmp, abb_destruir_dato_t destruir_dato,
+                       size_t max_cantidad, size_t max_bytes)
+{
+    abb_t *arbol = abb_crear(cmp, destruir_dato);
+
+    if (!arbol) {
+        return NULL;
+    }
+    arbol->referencias = malloc(NODOS_INICIAL);
+    arbol->nodos = malloc(NODOS_INICIAL * sizeof(abb_nodo_t));
+    if (!arbol->referencias || !arbol->nodos) {
+        abb_destruir(arbol);
+        return NULL;
+    }
+    arbol->capacidad = NODOS_INICIAL;
+    arbol->max_cantidad = max_cantidad;
+    arbol->max_bytes = max_bytes;
+    return arbol;
+}
+
+abb_t *abb_crear_agregado(abb_comparar_clave_t cmp, abb_destruir_dato_t destruir_dato,
+                          const abb_agregado_t *agregado)
+{
+    abb_t *arbol = abb_crear(cmp, destruir_dato);
+
+    if (!arbol) {
+        return NULL;
+    }
+    if (!abb_mantener_agregado(arbol, agregado)) {
+        abb_destruir(arbol);
+        return NULL;
+    }
+    return arbol;
+}
+
+bool abb_mantener_agregado(abb_t *arbol, const abb_agregado_t *agregado)
+{
+    if (arbol->agregados || arbol->archivo) {
+        return false;
+    }
+    /* Los agregados acompañan al arreglo de nodos: hace falta que exista */
+    if (!arbol->capacidad && !reservar_nodos(arbol, 1)) {
+        return false;
+    }
+    arbol->agregados = malloc(arbol->capacidad * sizeof(int64_t));
+    if (!arbol->agregados) {
+        return false;
+    }
+    arbol->agregado = *agregado;
+    agregados_calcular(arbol, arbol->raiz);
+    return true;
+}
+
+/* Devuelve una copia de los primeros usado bytes de origen en un bloque de
+ * capacidad bytes, o NULL si origen es NULL. Si no hay memoria pone ok en false */
+static void *copiar_arreglo(const void *origen, size_t usado, size_t capacidad, bool *ok)
+{
+    void *copia;
+
+    if (!origen) {
+        return NULL;
+    }
+    copia = malloc(capacidad ? capacidad : 1);
+    if (!copia) {
+        *ok = false;
+        return NULL;
+    }
+    memcpy(copia, origen, usado);
+    return copia;
+}
+
+/* Guarda el par clave-dato con el instante de vencimiento dado (0 si no vence) */
+static bool guardar(abb_t *arbol, const char *clave, void *dato, uint64_t vencimiento)
+{
+    size_t largo = strlen(clave);
+    char *copia = NULL;
+    void *copia_dato = NULL;
+    size_t cantidad = arbol->cantidad;
+    uint32_t nodo;
+
+    /* Reservar puede mover las claves; si la clave recibida es una de ellas la copio */
+    if (clave >= arbol->claves && clave < arbol->claves + arbol->claves_usado) {
+        copia = strdup(clave);
+        if (!copia) {
+            return false;
+        }
+        clave = copia;
+    }
+    /* En archivo pasa lo mismo con los datos, que además se copian de a bytes */
+    if (en_datos(arbol, dato)) {
+        copia_dato = malloc(arbol->tam_dato);
+        if (!copia_dato) {
+            free(copia);
+            return false;
+        }
+        memcpy(copia_dato, dato, arbol->tam_dato);
+        dato = copia_dato;
+    }
+    if (arbol->archivo) {
+        archivo_mantener(arbol);
+    }
+    if (arbol->archivo ? !reservar_camino(arbol, clave, entrada_largo(arbol, largo)) : !reservar(arbol, largo)) {
+        free(copia);
+        free(copia_dato);
+        return false;
+    }
+    if (vencimiento && !reservar_vencimientos(arbol)) {
+        free(copia);
+        free(copia_dato);
+        return false;
+    }
+    /* Registro antes de modificar: si no se pudo registrar, no se guarda */
+    if (arbol->bitacora && !bitacora_registrar(arbol->bitacora, BITACORA_GUARDAR, clave, vencimiento_pared(vencimiento),
+                                               dato, arbol->serializar)) {
+        free(copia);
+        free(copia_dato);
+        return false;
+    }
+    arbol->raiz = insertar_nodo(arbol, arbol->raiz, clave, largo, dato, &nodo);
+    free(copia);
+    free(copia_dato);
+    if (arbol->bitacora) {
+        bitacora_mantener(arbol);
+    }
+    if (arbol->filtro) {
+        filtro_mantener(arbol);
+    }
+    if (arbol->vencimientos) {
+        /* Si el reemplazo vence en el mismo instante, la entrada encolada sigue valiendo */
+        bool encolado = cantidad == arbol->cantidad && arbol->vencimientos[nodo] == vencimiento;
+        arbol->vencimientos[nodo] = vencimiento;
+        if (vencimiento && !encolado) {
+            cola_encolar(arbol, vencimiento, nodo);
+        }
+    }
+    if (arbol->referencias) {
+        /* Guardar cuenta como uso: un elemento nuevo sobrevive al menos
+         * una vuelta de la manecilla */
+        arbol->referencias[nodo] = 1;
+        desalojar(arbol, nodo);
+    }
+	return true;
+}
+
+bool abb_guardar(abb_t *arbol, const char *clave, void *dato)
+{
+    return guardar(arbol, clave, dato, 0);
+}
+
+bool abb_guardar_con_ttl(abb_t *arbol, const char *clave, void *dato, size_t ttl_ms)
+{
+    if (arbol->archivo) {
+        return false;
+    }
+    return guardar(arbol, clave, dato, ahora_ms() + ttl_ms);
+}
+
+void *abb_borrar(abb_t *arbol, const char *clave)
+{
+    void *dato_salida;
+    bool vencido;
+
+    if (!quitar(arbol, clave, &dato_salida, &vencido)) {
+        return NULL;
+    }
+    if (vencido) {
+        /* Para el usuario ya no estaba: lo destruyo como si lo hubiera hecho abb_expirar */
+        if (arbol->destruir_dato) {
+            arbol->destruir_dato(dato_salida);
+        }
+        return NULL;
+    }
+	return dato_salida;
+}
+
+void *abb_obtener(const abb_t *arbol, const char *clave)
+{
+	uint32_t nodo_salida;
+
+    nodo_salida = buscar(arbol, clave);
+    if (nodo_salida == NINGUNO || nodo_vencido(arbol, nodo_salida))
+        return NULL;
+    marcar_usado(arbol, nodo_salida);
+    return nodo_dato(arbol, nodo_salida);
+}
+
+bool abb_pertenece(const abb_t *arbol, const char *clave)
+{
+	uint32_t nodo_salida;
+
+    nodo_salida = buscar(arbol, clave);
+    if (nodo_salida == NINGUNO || nodo_vencido(arbol, nodo_salida))
+        return false;
+    marcar_usado(arbol, nodo_salida);
+    return true;
+}
+
+size_t abb_cantidad(abb_t *arbol)
+{
+	return arbol->cantidad;
+}
+
+/* Versión de abb_aplicar_lote para un ABB en archivo, donde cada operación
+ * copia su camino: se aplican de a una. Antes se reserva lo de todas, con
+ * los caminos del ABB sin modificar, así una vez empezado el lote no falla */
+static bool lote_aplicar_archivo(abb_t *arbol, abb_operacion_t *operaciones, size_t cantidad)
+{
+    size_t nodos = 0, bytes = 0;
+    char *copias = NULL;
+
+    archivo_mantener(arbol);
+    for (size_t k = 0; k < cantidad; k++) {
+        nodos += largo_camino(arbol, operaciones[k].clave) + 1;
+        if (operaciones[k].tipo == ABB_GUARDAR) {
+            bytes += entrada_largo(arbol, strlen(operaciones[k].clave));
+            /* Si algún dato está en el propio archivo, copio los de todas antes de reservar */
+            if (!copias && en_datos(arbol, operaciones[k].dato)) {
+                copias = malloc(cantidad * arbol->tam_dato);
+                if (!copias) {
+                    return false;
+                }
+            }
+        }
+    }
+    for (size_t k = 0; copias && k < cantidad; k++) {
+        if (operaciones[k].tipo == ABB_GUARDAR) {
+            memcpy(copias + k * arbol->tam_dato, operaciones[k].dato, arbol->tam_dato);
+        }
+    }
+    if (!reservar_archivo(arbol, nodos, bytes, cantidad)) {
+        free(copias);
+        return false;
+    }
+    for (size_t k = 0; k < cantidad; k++) {
+        const char *clave = operaciones[k].clave;
+        uint32_t nodo;
+        if (operaciones[k].tipo == ABB_GUARDAR) {
+            void *dato = copias ? copias + k * arbol->tam_dato : operaciones[k].dato;
+            arbol->raiz = insertar_nodo(arbol, arbol->raiz, clave, strlen(clave), dato, &nodo);
+            continue;
+        }
+        /* El dato borrado sigue en su lugar hasta el próximo punto de control */
+        arbol->raiz = buscar_nodo_borrar(arbol, arbol->raiz, clave, &nodo);
+        operaciones[k].dato = NULL;
+        if (nodo != NINGUNO) {
+            operaciones[k].dato = nodo_dato(arbol, nodo);
+            --(arbol->cantidad);
+            nodo_liberar(arbol, nodo);
+        }
+    }
+    free(copias);
+    return true;
+}
+
+bool abb_aplicar_lote(abb_t *arbol, abb_operacion_t *operaciones, size_t cantidad)
+{
+    size_t *guardados, *indices;
+    size_t bytes = 0;
+    lote_t lote;
+
+    if (arbol->archivo) {
+        return lote_aplicar_archivo(arbol, operaciones, cantidad);
+    }
+    guardados = malloc((cantidad + 1) * sizeof(size_t));
+    indices = malloc((cantidad + 1) * sizeof(size_t));
 
-typedef struct abb{
-	abb_nodo_t *raiz;
-	abb_comparar_clave_t cmp;
-	abb_destruir_dato_t destruir_dato;
-	size_t cantidad;
-} abb_t;
+    if (!guardados || !indices) {
+        free(guardados);
+        free(indices);
+        return false;
+    }
+    guardados[0] = 0;
+    for (size_t k = 0; k < cantidad; k++) {
+        guardados[k + 1] = guardados[k];
+        if (operaciones[k].tipo == ABB_GUARDAR) {
+            indices[guardados[k + 1]++] = k;
+            bytes += strlen(operaciones[k].clave) + 1;
+        }
+    }
+    /* Reservo todo de antemano: una vez empezado, el lote no puede fallar */
+    if (!reservar_nodos(arbol, guardados[cantidad]) || !reservar_claves(arbol, bytes)
+        || !indice_reservar(arbol, guardados[cantidad])) {
+        free(guardados);
+        free(indices);
+        return false;
+    }
+    for (size_t k = 0; arbol->bitacora && k < cantidad; k++) {
+        /* Un error queda guardado en la bitácora y lo informa abb_bitacora_sincronizar */
+        if (operaciones[k].tipo == ABB_GUARDAR) {
+            bitacora_registrar(arbol->bitacora, BITACORA_GUARDAR, operaciones[k].clave, 0,
+                               operaciones[k].dato, arbol->serializar);
+        } else {
+            bitacora_registrar(arbol->bitacora, BITACORA_BORRAR, operaciones[k].clave, 0, NULL, NULL);
+        }
+    }
+    for (size_t k = 0; k < cantidad; k++) {
+        if (operaciones[k].tipo == ABB_BORRAR) {
+            operaciones[k].dato = NULL;
+        }
+    }
 
-typedef struct abb_iter {
-	pila_t *pila;
-} abb_iter_t;
+    lote.operaciones = operaciones;
+    lote.guardados = guardados;
+    lote.indices = indices;
+    lote.altura = 0;
+    lote.recorridos = 0;
+    arbol->raiz = lote_aplicar(arbol, &lote, arbol->raiz, 0, cantidad, 1);
+    free(guardados);
+    free(indices);
 
-/* *****************************************************************
- *                    Funciones auxiliares                         *
- * *****************************************************************/
+    /* Rebalancear cuesta O(n): se hace a lo sumo una vez cada n pasos de
+     * lote (nodos recorridos y operaciones aplicadas), así a lo sumo duplica
+     * lo que costaron los lotes */
+    arbol->pasos_lote += lote.recorridos + cantidad;
+    if (lote.altura > altura_tolerada(arbol->cantidad) && arbol->pasos_lote >= arbol->cantidad) {
+        rebalancear(arbol);
+        arbol->pasos_lote = 0;
+    }
+    if (arbol->bitacora) {
+        bitacora_mantener(arbol);
+    }
+    if (arbol->filtro) {
+        filtro_mantener(arbol);
+    }
+    if (arbol->referencias) {
+        desalojar(arbol, NINGUNO);
+    }
+    return true;
+}
 
-/* Crea un nodo para el ABB. Copia la clave. Si falla devuelve NULL */
-static abb_nodo_t *nodo_crear(const char *clave, void *dato, abb_nodo_t *izq, abb_nodo_t *der)
+int64_t abb_agregar_rango(const abb_t *arbol, const char *desde, const char *hasta)
 {
-	abb_nodo_t *nodo = malloc(sizeof(abb_nodo_t));
+    const abb_agregado_t *agregado = &arbol->agregado;
+    int64_t izquierda = agregado->identidad, derecha = agregado->identidad;
+    uint32_t i = arbol->raiz, division;
 
-	if (!nodo) {
-		return NULL;
+    /* Bajo hasta el primer nodo que cae dentro del rango: ahí se separan los
+     * caminos de las dos cotas */
+    while (i != NINGUNO) {
+        if (desde && arbol->cmp(nodo_clave(arbol, i), desde) < 0)
+            i = arbol->nodos[i].der;
+        else if (hasta && arbol->cmp(nodo_clave(arbol, i), hasta) > 0)
+            i = arbol->nodos[i].izq;
+        else
+            break;
     }
-	nodo->clave = strdup(clave);
-    if (!(nodo->clave)) {
-        free(nodo);
-        return NULL;
+    if (i == NINGUNO) {
+        return agregado->identidad;
+    }
+    division = i;
+
+    /* Del lado izquierdo, cada nodo mayor o igual a desde entra con todo su
+     * subárbol derecho. Los voy encontrando de derecha a izquierda */
+    for (i = arbol->nodos[division].izq; i != NINGUNO; ) {
+        const abb_nodo_t *nodo = &arbol->nodos[i];
+        if (desde && arbol->cmp(nodo_clave(arbol, i), desde) < 0) {
+            i = nodo->der;
+            continue;
+        }
+        izquierda = agregado->combinar(agregado_subarbol(arbol, nodo->der), izquierda);
+        izquierda = agregado->combinar(agregado->valor(nodo->dato), izquierda);
+        if (!desde) {
+            /* Sin cota entra el subárbol izquierdo entero */
+            izquierda = agregado->combinar(agregado_subarbol(arbol, nodo->izq), izquierda);
+            break;
+        }
+        i = nodo->izq;
+    }
+    /* Del lado derecho es simétrico, de izquierda a derecha */
+    for (i = arbol->nodos[division].der; i != NINGUNO; ) {
+        const abb_nodo_t *nodo = &arbol->nodos[i];
+        if (hasta && arbol->cmp(nodo_clave(arbol, i), hasta) > 0) {
+            i = nodo->izq;
+            continue;
+        }
+        derecha = agregado->combinar(derecha, agregado_subarbol(arbol, nodo->izq));
+        derecha = agregado->combinar(derecha, agregado->valor(nodo->dato));
+        if (!hasta) {
+            derecha = agregado->combinar(derecha, agregado_subarbol(arbol, nodo->der));
+            break;
+        }
+        i = nodo->der;
     }
-	nodo->dato = dato;
-	nodo->izq = izq;
-	nodo->der = der;
-	return nodo;
+    izquierda = agregado->combinar(izquierda, agregado->valor(arbol->nodos[division].dato));
+    return agregado->combinar(izquierda, derecha);
 }
 
-/* Destruye el nodo recibido y sus hijos. Aplica destruir_dato al dato si es distinto de NULL */
-static void destruir_nodos(abb_nodo_t *nodo, void destruir_dato(void *))
+abb_t *abb_clonar(const abb_t *arbol, abb_copiar_dato_t copiar_dato)
 {
-    if (!nodo) {
-        return;
+    abb_t *clon;
+    bool ok = true;
+
+    if (arbol->archivo) {
+        return NULL;
+    }
+    clon = malloc(sizeof(abb_t));
+    if (!clon) {
+        return NULL;
+    }
+    /* Los nodos se enlazan por índices, así que copiar los arreglos tal cual
+     * copia también la forma del ABB, la lista de libres y los índices */
+    *clon = *arbol;
+    clon->bitacora = NULL;
+    clon->serializar = NULL;
+    clon->deserializar = NULL;
+    clon->siguiente_diferido = NULL;
+    clon->nodos = copiar_arreglo(arbol->nodos, arbol->usados * sizeof(abb_nodo_t),
+                                 arbol->capacidad * sizeof(abb_nodo_t), &ok);
+    clon->claves = copiar_arreglo(arbol->claves, arbol->claves_usado, arbol->claves_capacidad, &ok);
+    clon->referencias = copiar_arreglo(arbol->referencias, arbol->usados, arbol->capacidad, &ok);
+    clon->agregados = copiar_arreglo(arbol->agregados, arbol->usados * sizeof(int64_t),
+                                     arbol->capacidad * sizeof(int64_t), &ok);
+    clon->indice = copiar_arreglo(arbol->indice, arbol->indice_capacidad * sizeof(entrada_indice_t),
+                                  arbol->indice_capacidad * sizeof(entrada_indice_t), &ok);
+    clon->vencimientos = copiar_arreglo(arbol->vencimientos, arbol->usados * sizeof(uint64_t),
+                                        arbol->capacidad * sizeof(uint64_t), &ok);
+    clon->cola = copiar_arreglo(arbol->cola, arbol->cola_cantidad * sizeof(vencimiento_t),
+                                arbol->cola_capacidad * sizeof(vencimiento_t), &ok);
+    if (arbol->filtro) {
+        clon->filtro = filtro_reservar(arbol->filtro_bloques);
+        if (clon->filtro) {
+            memcpy(clon->filtro, arbol->filtro, arbol->filtro_bloques * FILTRO_BLOQUE);
+        } else {
+            ok = false;
+        }
     }
-    destruir_nodos(nodo->izq, destruir_dato);
-    destruir_nodos(nodo->der, destruir_dato);
-    if (destruir_dato) {
-        destruir_dato(nodo->dato);
+    if (!ok) {
+        /* Los datos todavía son los del original: no hay que destruirlos */
+        clon->usados = 0;
+        clon->destruir_dato = NULL;
+        abb_destruir(clon);
+        return NULL;
+    }
+    if (!copiar_dato) {
+        /* Los datos son del original: el clon no los puede destruir */
+        clon->destruir_dato = NULL;
+        return clon;
+    }
+    for (size_t i = 0; i < clon->usados; i++) {
+        void *dato = clon->nodos[i].dato;
+
+        if (clon->nodos[i].clave == NINGUNO) {
+            continue;
+        }
+        clon->nodos[i].dato = copiar_dato(dato);
+        if (dato && !clon->nodos[i].dato) {
+            /* Se destruyen solo las copias hechas: desde i siguen siendo del original */
+            clon->usados = i;
+            abb_destruir(clon);
+            return NULL;
+        }
     }
-    free(nodo->clave);
-    free(nodo);
+    return clon;
 }
 
-/* Devuelve el nodo que tiene la clave igual a la clave dada, comparando con la función recibida
- * Si no lo encuentra devuelve NULL */
-static abb_nodo_t *buscar_nodo(abb_nodo_t *nodo, const char *clave, abb_comparar_clave_t cmp)
+bool abb_indexar(abb_t *arbol)
 {
-	if (!nodo)
-        return NULL;
-	else if (cmp(clave, nodo->clave) == 0)
-		return nodo;
-	else if (cmp(clave, nodo->clave) < 0)
-		return buscar_nodo(nodo->izq, clave, cmp);
-	else
-        return buscar_nodo(nodo->der, clave, cmp);
-}
-
-/* Inserta un nodo */
-static abb_nodo_t *insertar_nodo(abb_nodo_t *nodo, abb_nodo_t *nuevo, abb_comparar_clave_t cmp, abb_destruir_dato_t destruir_dato, size_t *cantidad)
-{
-    if (!nodo) {
-        ++(*cantidad);
-        return nuevo;
-    } else if (cmp(nuevo->clave, nodo->clave) > 0) {
-        nodo->der = insertar_nodo(nodo->der, nuevo, cmp, destruir_dato, cantidad);
-        return nodo;
-    } else if (cmp(nuevo->clave, nodo->clave) < 0) {
-        nodo->izq = insertar_nodo(nodo->izq, nuevo, cmp, destruir_dato, cantidad);
-        return nodo;
-    } else {
-        /* La clave pertenece al ABB, reemplazo el dato */
-        void *aux = nodo->dato;
-        nodo->dato = nuevo->dato;
-        if (destruir_dato) {
-            destruir_dato(aux);
+    size_t capacidad = INDICE_INICIAL;
+
+    if (arbol->indice) {
+        return true;
+    }
+    if (arbol->archivo) {
+        return false;
+    }
+    while (capacidad < 2 * (arbol->cantidad + 1)) {
+        capacidad *= 2;
+    }
+    arbol->indice = malloc(capacidad * sizeof(entrada_indice_t));
+    if (!arbol->indice) {
+        return false;
+    }
+    arbol->indice_capacidad = capacidad;
+    for (size_t pos = 0; pos < capacidad; pos++) {
+        arbol->indice[pos].nodo = NINGUNO;
+    }
+    for (size_t i = 0; i < arbol->usados; i++) {
+        if (arbol->nodos[i].clave != NINGUNO) {
+            indice_insertar(arbol, (uint32_t) i);
         }
-        /* No necesito las otras partes del nodo creado, las libero */
-        free(nuevo->clave);
-        free(nuevo);
-        return nodo;
     }
+    return true;
 }
 
-/* Busca el nodo con la mayor clave en el subárbol dado, lo devuelve a través de maximo */
-static abb_nodo_t *buscar_maximo(abb_nodo_t *actual, abb_nodo_t **maximo)
+bool abb_filtrar(abb_t *arbol, size_t capacidad, double tasa_falsos_positivos)
 {
-    if (!actual) {
-        *maximo = NULL;
-        return NULL;
-    } else if (actual->der) {
-        /* No estoy en el máximo todavía */
-        actual->der = buscar_maximo(actual->der, maximo);
-        return actual;
-    } else {
-        /* actual->der == NULL, actual es el máximo */
-        *maximo = actual;
-        return actual->izq;
+    size_t bits = 0;
+
+    if (arbol->filtro || arbol->archivo || tasa_falsos_positivos <= 0 || tasa_falsos_positivos >= 1) {
+        return false;
+    }
+    /* Un filtro de Bloom óptimo usa log2(1 / tasa) / ln 2 contadores por clave,
+     * y ln 2 veces esa cantidad de funciones. Juntar cada clave en un solo
+     * bloque reparte peor que el filtro entero: medido, hace falta alrededor
+     * de un 35% más de contadores y conviene usar menos funciones */
+    for (double x = tasa_falsos_positivos; x < 1; x *= 2) {
+        bits++;
     }
+    arbol->filtro_contadores = bits * 144 / 100 + bits / 2 + 1;
+    arbol->filtro_funciones = (unsigned) ((arbol->filtro_contadores + 1) / 2);
+    if (arbol->filtro_funciones > 16) {
+        arbol->filtro_funciones = 16;
+    }
+    return filtro_construir(arbol, capacidad > arbol->cantidad ? capacidad : arbol->cantidad);
 }
 
-/* Busca el nodo que debe borrar, lo borra y engancha el reemplazo con los hijos que tenía el nodo borrado */
-static abb_nodo_t *buscar_nodo_borrar(abb_nodo_t *actual, abb_comparar_clave_t cmp, const char *clave, abb_nodo_t **nodo_salida)
+size_t abb_expirar(abb_t *arbol, size_t max_trabajo)
 {
-    if (!actual) {
-        *nodo_salida = NULL;
-        return NULL;
-    } else if (cmp(clave, actual->clave) < 0) {
-        actual->izq = buscar_nodo_borrar(actual->izq, cmp, clave, nodo_salida);
-        return actual;
-    } else if (cmp(clave, actual->clave) > 0) {
-        actual->der = buscar_nodo_borrar(actual->der, cmp, clave, nodo_salida);
-        return actual;
-    } else {
-        /* clave == actual->clave, actual es el nodo a borrar */
-        abb_nodo_t *reemplazo;
-        abb_nodo_t *reemplazo_izq;
+    uint64_t ahora = ahora_ms();
+    size_t expirados = 0;
 
-        *nodo_salida = actual;
-        if (actual->izq) {
-            /* Tomamos como reemplazo al máximo del subárbol izquierdo */
-            reemplazo_izq = buscar_maximo(actual->izq, &reemplazo);
-        } else {
-            /* Si no hay árbol izquierdo, unimos al padre con el subárbol derecho */
-            return actual->der;
+    for (; max_trabajo && arbol->cola_cantidad && arbol->cola[0].instante <= ahora; max_trabajo--) {
+        vencimiento_t primero = arbol->cola[0];
+        void *dato;
+        bool vencido;
+
+        arbol->cola[0] = arbol->cola[--arbol->cola_cantidad];
+        cola_bajar(arbol->cola, arbol->cola_cantidad, 0);
+        if (!vencimiento_valido(arbol, primero)) {
+            /* El elemento se borró o se volvió a guardar después de encolarse */
+            continue;
         }
-        if (!reemplazo) {
-            return NULL;
+        quitar(arbol, nodo_clave(arbol, primero.nodo), &dato, &vencido);
+        if (arbol->destruir_dato) {
+            arbol->destruir_dato(dato);
         }
-        /* Si el reemplazo no es NULL (el borrado no es una hoja) */
-        /* Debo "salvar" a sus hijos */
-        reemplazo->izq = reemplazo_izq;
-        reemplazo->der = actual->der;
-        return reemplazo;
+        expirados++;
     }
+    return expirados;
 }
 
-/* Recorre los nodos en in-order recursivamente, comunicando con el valor de retorno en cada llamado si debe seguir la recursión */
-static bool abb_nodo_in_order(abb_nodo_t *nodo, bool visitar(const char *, void *, void *), void *extra)
+void abb_estadisticas(const abb_t *arbol, abb_estadisticas_t *estadisticas)
 {
-    if (!nodo)
-        return true; // Recorrió todo, porque no hay nada para recorrer
-    else if (!abb_nodo_in_order(nodo->izq,visitar,extra))
-        return false; // Si el subárbol izquierdo recibió false, devuelve false
-	else if (!visitar(nodo->clave,nodo->dato,extra))
-        return false; // Visita el nodo actual, comunica a las llamadas previas que deben terminar
-    else if (!abb_nodo_in_order(nodo->der,visitar,extra))
-        return false; // Si el subárbol derecho recibió false, devuelve false
-    else
+    estadisticas->cantidad = arbol->cantidad;
+    estadisticas->bytes_nodos = arbol->capacidad * (sizeof(abb_nodo_t) + (arbol->archivo ? dato_largo(arbol) : 0));
+    estadisticas->bytes_claves = arbol->claves_capacidad;
+    estadisticas->bytes_cache = arbol->referencias ? arbol->capacidad : 0;
+    estadisticas->bytes_vencimientos = arbol->vencimientos ? arbol->capacidad * sizeof(uint64_t) : 0;
+    estadisticas->bytes_vencimientos += arbol->cola_capacidad * sizeof(vencimiento_t);
+    estadisticas->bytes_indice = arbol->indice_capacidad * sizeof(entrada_indice_t);
+    estadisticas->bytes_agregados = arbol->agregados ? arbol->capacidad * sizeof(int64_t) : 0;
+    estadisticas->bytes_filtro = arbol->filtro_bloques * FILTRO_BLOQUE;
+    estadisticas->bytes_totales = sizeof(abb_t) + estadisticas->bytes_nodos + estadisticas->bytes_claves
+                                  + estadisticas->bytes_cache + estadisticas->bytes_vencimientos
+                                  + estadisticas->bytes_indice + estadisticas->bytes_agregados
+                                  + estadisticas->bytes_filtro;
+}
+
+/* Aplica al ABB un registro leído de la bitácora. El vencimiento viene en el
+ * reloj de pared: si ya pasó, el elemento no vuelve */
+static bool aplicar_registro(char tipo, const char *clave, uint64_t vencimiento, const void *bytes, size_t largo,
+                             void *extra)
+{
+    abb_t *arbol = extra;
+    uint64_t pared = pared_ms();
+    void *dato = NULL;
+
+    if (tipo == BITACORA_BORRAR || (vencimiento && vencimiento <= pared)) {
+        dato = abb_borrar(arbol, clave);
+        if (dato && arbol->destruir_dato) {
+            arbol->destruir_dato(dato);
+        }
         return true;
+    }
+    if (arbol->deserializar) {
+        dato = arbol->deserializar(bytes, largo);
+    }
+    return guardar(arbol, clave, dato, vencimiento ? vencimiento - pared + ahora_ms() : 0);
 }
 
-/* Apila todos los nodos en in-order en una pila válida dada */
-static void apilar_nodos_in(pila_t *pila, abb_nodo_t *nodo)
+bool abb_bitacora_abrir(abb_t *arbol, const char *ruta, abb_serializar_dato_t serializar,
+                        abb_deserializar_dato_t deserializar, size_t lote)
 {
-    if (!nodo) {
-        return;
+    bitacora_t *bitacora;
+
+    if (arbol->bitacora || arbol->archivo) {
+        return false;
+    }
+    bitacora = bitacora_abrir(ruta, lote);
+    if (!bitacora) {
+        return false;
+    }
+    /* Mientras se reproduce, la bitácora no está enganchada y no se vuelve a registrar nada */
+    arbol->serializar = serializar;
+    arbol->deserializar = deserializar;
+    if (!bitacora_reproducir(bitacora, aplicar_registro, arbol)) {
+        bitacora_cerrar(bitacora);
+        return false;
     }
-    /* El orden en el que hay que apilar es el inverso al in-order
-     * por ser una pila. Primero todo el subarbol derecho y luego el izquierdo */
-    apilar_nodos_in(pila, nodo->der);
-    pila_apilar(pila, nodo);
-    apilar_nodos_in(pila, nodo->izq);
+    arbol->bitacora = bitacora;
+    return true;
 }
 
-/* *****************************************************************
- *                    Primitivas del ABB                           *
- * *****************************************************************/
+bool abb_bitacora_sincronizar(abb_t *arbol)
+{
+    return !arbol->bitacora || bitacora_sincronizar(arbol->bitacora);
+}
 
-abb_t *abb_crear(abb_comparar_clave_t cmp, abb_destruir_dato_t destruir_dato)
+/* Para ordenar los espacios de claves por desplazamiento */
+static int extension_comparar(const void *a, const void *b)
 {
-	abb_t *arbol = malloc(sizeof(abb_t));
+    uint32_t desde_a = ((const extension_t *) a)->desde, desde_b = ((const extension_t *) b)->desde;
 
-	if (!arbol) {
-        return NULL;
+    return desde_a < desde_b ? -1 : desde_a > desde_b;
+}
+
+/* Pone en las listas de libres el hueco de claves dado, partido en espacios
+ * de las clases más grandes que entran */
+static void hueco_soltar(abb_t *arbol, size_t desde, size_t bytes)
+{
+    while (bytes) {
+        size_t largo = CLASES_EXACTAS * ALINEACION;
+        if (bytes >= CLASE_POTENCIA) {
+            for (largo = CLASE_POTENCIA; largo * 2 <= bytes; largo *= 2) {
+            }
+        } else if (bytes < largo) {
+            largo = bytes;
+        }
+        extension_soltar(arbol, (uint32_t) desde, clase(largo));
+        desde += largo;
+        bytes -= largo;
     }
-	arbol->raiz = NULL;
-	arbol->cantidad = 0;
-	arbol->cmp = cmp;
-	arbol->destruir_dato = destruir_dato;
-	return arbol;
 }
 
-bool abb_guardar(abb_t *arbol, const char *clave, void *dato)
+/* Rehace las listas de espacios de claves libres con los huecos que dejan las
+ * entradas de los cantidad nodos vivos dados. Si las entradas se pisan o se
+ * salen de lo usado, el archivo no es válido y devuelve false */
+static bool huecos_rehacer(abb_t *arbol, extension_t *vivas, size_t cantidad)
 {
-	abb_nodo_t *nuevo;
+    size_t desde = 0;
 
-    nuevo = nodo_crear(clave, dato, NULL, NULL);
-	if (!nuevo) {
+    qsort(vivas, cantidad, sizeof(extension_t), extension_comparar);
+    for (size_t c = 0; c < ARCHIVO_CLASES; c++) {
+        arbol->claves_libres[c] = NINGUNO;
+    }
+    for (size_t k = 0; k < cantidad; k++) {
+        if (vivas[k].desde < desde || vivas[k].desde % ALINEACION) {
+            return false;
+        }
+        hueco_soltar(arbol, desde, vivas[k].desde - desde);
+        desde = vivas[k].desde + clase_largo(vivas[k].clase);
+    }
+    if (desde > arbol->claves_usado) {
         return false;
     }
-    arbol->raiz = insertar_nodo(arbol->raiz, nuevo, arbol->cmp, arbol->destruir_dato, &(arbol->cantidad));
-	return true;
+    hueco_soltar(arbol, desde, arbol->claves_usado - desde);
+    return true;
 }
 
-void *abb_borrar(abb_t *arbol, const char *clave)
+/* Después de una caída, las listas de libres del archivo no son confiables:
+ * puede haber nodos y espacios de claves tomados después del último punto de
+ * control. Las rehace con los nodos que no alcanza la raíz y los huecos entre
+ * sus claves, y de paso recalcula las cuentas. Si el ABB del archivo no es
+ * válido devuelve false */
+static bool recuperar(abb_t *arbol)
 {
-    abb_nodo_t *borrado;
-    void *dato_salida;
+    uint8_t *alcanzados = calloc(arbol->usados ? arbol->usados : 1, 1);
+    uint32_t *pendientes = malloc((arbol->usados ? arbol->usados : 1) * sizeof(uint32_t));
+    extension_t *vivas = malloc((arbol->usados ? arbol->usados : 1) * sizeof(extension_t));
+    size_t cantidad = 0, tope = 0, claves_vivas = 0;
+    bool ok = true;
 
-	arbol->raiz = buscar_nodo_borrar(arbol->raiz, arbol->cmp, clave, &borrado);
-    if (!borrado) {
-        return NULL;
+    if (!alcanzados || !pendientes || !vivas) {
+        free(alcanzados);
+        free(pendientes);
+        free(vivas);
+        return false;
     }
-    dato_salida = borrado->dato;
-    --(arbol->cantidad);
-    free(borrado->clave);
-    free(borrado);
-	return dato_salida;
+    if (arbol->raiz != NINGUNO) {
+        pendientes[tope++] = arbol->raiz;
+    }
+    while (ok && tope) {
+        uint32_t i = pendientes[--tope];
+        const abb_nodo_t *nodo = &arbol->nodos[i];
+        if (alcanzados[i] || nodo->clave >= arbol->claves_usado) {
+            ok = false;
+            break;
+        }
+        alcanzados[i] = 1;
+        vivas[cantidad].desde = nodo->clave;
+        vivas[cantidad].clase = (uint32_t) clase(entrada_largo(arbol, nodo->largo));
+        cantidad++;
+        claves_vivas += entrada_largo(arbol, nodo->largo);
+        /* En un ABB válido cada nodo se apila una sola vez, así que la pila
+         * no pasa de usados; si pasa, algún nodo tiene dos padres */
+        ok = (nodo->izq == NINGUNO || nodo->izq < arbol->usados) && (nodo->der == NINGUNO || nodo->der < arbol->usados);
+        if (ok && nodo->izq != NINGUNO) {
+            ok = tope < arbol->usados;
+            if (ok) {
+                pendientes[tope++] = nodo->izq;
+            }
+        }
+        if (ok && nodo->der != NINGUNO) {
+            ok = tope < arbol->usados;
+            if (ok) {
+                pendientes[tope++] = nodo->der;
+            }
+        }
+    }
+    ok = ok && huecos_rehacer(arbol, vivas, cantidad);
+    if (ok) {
+        arbol->libres = NINGUNO;
+        for (size_t i = arbol->usados; i-- > 0; ) {
+            if (!alcanzados[i]) {
+                abb_nodo_t *nodo = &arbol->nodos[i];
+                nodo->clave = NINGUNO;
+                nodo->dato = NULL;
+                nodo->izq = NINGUNO;
+                nodo->der = arbol->libres;
+                arbol->libres = (uint32_t) i;
+            }
+        }
+        arbol->cantidad = cantidad;
+        arbol->bytes = cantidad * (sizeof(abb_nodo_t) + dato_largo(arbol)) + claves_vivas;
+        arbol->claves_basura = arbol->claves_usado - claves_vivas;
+    }
+    free(alcanzados);
+    free(pendientes);
+    free(vivas);
+    return ok;
 }
 
-void *abb_obtener(const abb_t *arbol, const char *clave)
+/* Cierra el archivo de un ABB que no llegó a abrirse, sin escribir nada */
+static abb_t *abandonar_archivo(abb_t *arbol)
 {
-	abb_nodo_t *nodo_salida;
-
-    nodo_salida = buscar_nodo(arbol->raiz, clave, arbol->cmp);
-    if (!nodo_salida)
-        return NULL;
-    else
-        return nodo_salida->dato;
+    archivo_cerrar(arbol->archivo);
+    arbol->archivo = NULL;
+    arbol->nodos = NULL;
+    arbol->claves = NULL;
+    arbol->datos = NULL;
+    abb_destruir(arbol);
+    return NULL;
 }
 
-bool abb_pertenece(const abb_t *arbol, const char *clave)
+abb_t *abb_abrir_archivo(const char *ruta, abb_comparar_clave_t cmp, size_t tam_dato)
 {
-	abb_nodo_t *nodo_salida;
+    abb_t *arbol = abb_crear(cmp, NULL);
+    archivo_encabezado_t encabezado;
+    size_t bytes;
 
-    nodo_salida = buscar_nodo(arbol->raiz, clave, arbol->cmp);
-    if (!nodo_salida)
-        return false;
-    else
-        return true;
+    if (!arbol) {
+        return NULL;
+    }
+    arbol->archivo = archivo_abrir(ruta, &encabezado);
+    if (!arbol->archivo) {
+        abb_destruir(arbol);
+        return NULL;
+    }
+    arbol->tam_dato = tam_dato;
+    arbol->nodos = archivo_nodos(arbol->archivo, &bytes);
+    arbol->capacidad = bytes / sizeof(abb_nodo_t) < NINGUNO ? bytes / sizeof(abb_nodo_t) : NINGUNO;
+    arbol->datos = archivo_datos(arbol->archivo, &bytes);
+    if (tam_dato && bytes / dato_largo(arbol) < arbol->capacidad) {
+        /* Los datos se agrandan antes que los nodos, así que no debería pasar */
+        arbol->capacidad = bytes / dato_largo(arbol);
+    }
+    arbol->claves = archivo_claves(arbol->archivo, &arbol->claves_capacidad);
+    if (encabezado.secuencia) {
+        if (encabezado.tam_dato != tam_dato || encabezado.usados > arbol->capacidad
+            || encabezado.claves_usado > arbol->claves_capacidad
+            || (encabezado.raiz != NINGUNO && encabezado.raiz >= encabezado.usados)) {
+            return abandonar_archivo(arbol);
+        }
+        arbol->usados = encabezado.usados;
+        arbol->cantidad = encabezado.cantidad;
+        arbol->bytes = encabezado.bytes;
+        arbol->claves_usado = encabezado.claves_usado;
+        arbol->claves_basura = encabezado.claves_basura;
+        arbol->raiz = encabezado.raiz;
+        arbol->libres = encabezado.libres;
+    }
+    /* Todos los nodos del archivo son de la época 0, anterior a la actual */
+    arbol->epocas = calloc(arbol->capacidad ? arbol->capacidad : 1, sizeof(uint32_t));
+    arbol->claves_libres = malloc(ARCHIVO_CLASES * sizeof(uint32_t));
+    arbol->epoca = 1;
+    if (!arbol->epocas || !arbol->claves_libres) {
+        return abandonar_archivo(arbol);
+    }
+    for (size_t c = 0; c < ARCHIVO_CLASES; c++) {
+        bool valida = encabezado.claves_libres[c] == NINGUNO || encabezado.claves_libres[c] < arbol->claves_usado;
+        arbol->claves_libres[c] = encabezado.secuencia && valida ? encabezado.claves_libres[c] : NINGUNO;
+        encabezado.limpio = encabezado.limpio && valida;
+    }
+    if (encabezado.secuencia && !encabezado.limpio && !recuperar(arbol)) {
+        return abandonar_archivo(arbol);
+    }
+    /* Desde acá la lista de libres cambia sin punto de control: hasta que se
+     * cierre bien, el archivo queda marcado para recuperarla */
+    if (!punto_de_control(arbol, false)) {
+        return abandonar_archivo(arbol);
+    }
+    return arbol;
 }
 
-size_t abb_cantidad(abb_t *arbol)
+bool abb_archivo_sincronizar(abb_t *arbol)
 {
-	return arbol->cantidad;
+    return !arbol->archivo || (punto_de_control(arbol, false) && !arbol->archivo_error);
 }
 
 void abb_destruir(abb_t *arbol)
 {
     if (!arbol) return;
-	if (arbol->raiz) {
-        destruir_nodos(arbol->raiz, arbol->destruir_dato);
+    if (arbol->archivo) {
+        /* Si no se puede cerrar limpio, al abrirlo se recupera del último punto de control */
+        if (punto_de_control(arbol, false)) {
+            punto_de_control(arbol, true);
+        }
+        archivo_cerrar(arbol->archivo);
+        arbol->nodos = NULL;
+        arbol->claves = NULL;
+        arbol->datos = NULL;
     }
+    bitacora_cerrar(arbol->bitacora);
+    destruir_nodos(arbol);
+    free(arbol->nodos);
+    free(arbol->claves);
+    free(arbol->referencias);
+    free(arbol->agregados);
+    free(arbol->epocas);
+    free(arbol->liberados);
+    free(arbol->claves_libres);
+    free(arbol->extensiones);
+    free(arbol->filtro);
+    free(arbol->indice);
+    free(arbol->vencimientos);
+    free(arbol->cola);
 	free(arbol);
 }
 
+/* Destruye el ABB por tandas de nodos, cediendo el procesador entre una y
+ * otra para no acaparar el asignador de memoria frente a los demás hilos */
+static void destruir_en_tandas(abb_t *arbol)
+{
+    if (arbol->destruir_dato) {
+        for (size_t desde = 0; desde < arbol->usados; desde += RECLAMO_TANDA) {
+            size_t hasta = arbol->usados - desde < RECLAMO_TANDA ? arbol->usados : desde + RECLAMO_TANDA;
+            for (size_t i = desde; i < hasta; i++) {
+                if (arbol->nodos[i].clave != NINGUNO) {
+                    arbol->destruir_dato(arbol->nodos[i].dato);
+                }
+            }
+            sched_yield();
+        }
+        arbol->destruir_dato = NULL;
+    }
+    abb_destruir(arbol);
+}
+
+/* Cuerpo del hilo de reclamo: destruye los ABB de la cola en orden hasta que
+ * se le pida salir y la cola quede vacía */
+static void *reclamar(void *extra)
+{
+    (void) extra;
+    pthread_mutex_lock(&reclamo.mutex);
+    while (true) {
+        abb_t *arbol;
+
+        while (!reclamo.primero && !reclamo.salir) {
+            pthread_cond_wait(&reclamo.hay_trabajo, &reclamo.mutex);
+        }
+        if (!reclamo.primero) {
+            break;
+        }
+        arbol = reclamo.primero;
+        reclamo.primero = arbol->siguiente_diferido;
+        if (!reclamo.primero) {
+            reclamo.ultimo = NULL;
+        }
+        pthread_mutex_unlock(&reclamo.mutex);
+        destruir_en_tandas(arbol);
+        pthread_mutex_lock(&reclamo.mutex);
+        if (--reclamo.pendientes == 0) {
+            pthread_cond_broadcast(&reclamo.terminado);
+        }
+    }
+    pthread_mutex_unlock(&reclamo.mutex);
+    return NULL;
+}
+
+void abb_destruir_diferido(abb_t *arbol)
+{
+    if (!arbol) return;
+    if (arbol->archivo) {
+        /* En archivo no hay nodos en el heap que liberar por tandas */
+        abb_destruir(arbol);
+        return;
+    }
+    /* La bitácora se cierra acá, para que al volver ya esté en disco */
+    bitacora_cerrar(arbol->bitacora);
+    arbol->bitacora = NULL;
+    arbol->siguiente_diferido = NULL;
+
+    pthread_mutex_lock(&reclamo.mutex);
+    if (!reclamo.activo) {
+        if (pthread_create(&reclamo.hilo, NULL, reclamar, NULL) != 0) {
+            /* Sin hilo no queda otra que destruirlo ahora */
+            pthread_mutex_unlock(&reclamo.mutex);
+            abb_destruir(arbol);
+            return;
+        }
+        reclamo.activo = true;
+    }
+    if (reclamo.ultimo) {
+        reclamo.ultimo->siguiente_diferido = arbol;
+    } else {
+        reclamo.primero = arbol;
+    }
+    reclamo.ultimo = arbol;
+    reclamo.pendientes++;
+    pthread_cond_signal(&reclamo.hay_trabajo);
+    pthread_mutex_unlock(&reclamo.mutex);
+}
+
+void abb_esperar_destrucciones(void)
+{
+    pthread_mutex_lock(&reclamo.mutex);
+    while (reclamo.pendientes) {
+        pthread_cond_wait(&reclamo.terminado, &reclamo.mutex);
+    }
+    if (!reclamo.activo) {
+        pthread_mutex_unlock(&reclamo.mutex);
+        return;
+    }
+    reclamo.salir = true;
+    pthread_cond_signal(&reclamo.hay_trabajo);
+    pthread_mutex_unlock(&reclamo.mutex);
+    pthread_join(reclamo.hilo, NULL);
+
+    pthread_mutex_lock(&reclamo.mutex);
+    reclamo.activo = false;
+    reclamo.salir = false;
+    pthread_mutex_unlock(&reclamo.mutex);
+}
+
 /* *****************************************************************
  *                 Primitivas del iterador interno                 *
  * *****************************************************************/
 
 void abb_in_order(abb_t *arbol, bool visitar(const char *, void *, void *), void *extra)
 {
-    abb_nodo_in_order(arbol->raiz,visitar,extra);
+    abb_nodo_in_order(arbol, arbol->raiz, visitar, extra);
+}
+
+size_t abb_contar_prefijo(const abb_t *arbol, const char *prefijo)
+{
+    return contar_prefijo(arbol, arbol->raiz, prefijo, strlen(prefijo));
+}
+
+bool abb_in_order_lote(abb_t *arbol, abb_par_t *buffer, size_t capacidad,
+                       bool visitar(abb_par_t *, size_t, void *), void *extra)
+{
+    /* Recorrido sin recursión: el camino desde la raíz se guarda en un arreglo */
+    uint32_t camino_inicial[64];
+    uint32_t *camino = camino_inicial;
+    size_t tope = 0, largo_camino = 64, n = 0;
+    uint32_t i = arbol->raiz;
+    bool seguir = true;
+
+    while (seguir && (i != NINGUNO || tope)) {
+        /* Bajo por la izquierda guardando el camino */
+        while (i != NINGUNO) {
+            if (tope == largo_camino) {
+                uint32_t *nuevo = malloc(2 * largo_camino * sizeof(uint32_t));
+                if (!nuevo) {
+                    if (camino != camino_inicial) free(camino);
+                    return false;
+                }
+                memcpy(nuevo, camino, tope * sizeof(uint32_t));
+                if (camino != camino_inicial) free(camino);
+                camino = nuevo;
+                largo_camino *= 2;
+            }
+            camino[tope++] = i;
+            i = arbol->nodos[i].izq;
+        }
+        i = camino[--tope];
+        buffer[n].clave = nodo_clave(arbol, i);
+        buffer[n].dato = nodo_dato(arbol, i);
+        if (++n == capacidad) {
+            seguir = visitar(buffer, n, extra);
+            n = 0;
+        }
+        i = arbol->nodos[i].der;
+    }
+    if (seguir && n) {
+        visitar(buffer, n, extra);
+    }
+    if (camino != camino_inicial) free(camino);
+    return true;
 }
 
 /* *****************************************************************
@@ -283,6 +2651,11 @@ void abb_in_order(abb_t *arbol, bool visitar(const char *, void *, void *), void
  * *****************************************************************/
 
 abb_iter_t *abb_iter_in_crear(const abb_t *arbol)
+{
+    return abb_iter_prefijo_crear(arbol, NULL, 0);
+}
+
+abb_iter_t *abb_iter_prefijo_crear(const abb_t *arbol, const char *prefijo, size_t limite)
 {
 	abb_iter_t *iter = malloc(sizeof(abb_iter_t));
     pila_t *pila;
@@ -295,41 +2668,161 @@ abb_iter_t *abb_iter_in_crear(const abb_t *arbol)
 		free(iter);
 		return NULL;
 	}
+    iter->arbol = arbol;
 	iter->pila = pila;
+    iter->prefijo = NULL;
+    iter->largo_prefijo = 0;
+    iter->restantes = limite ? limite : SIZE_MAX;
 
-    /* Apila todos los nodos en in-order */
-    apilar_nodos_in(iter->pila, arbol->raiz);
+    if (!prefijo) {
+        /* Apila el camino hasta el primer nodo en in-order */
+        apilar_izquierdos(iter->pila, arbol, arbol->raiz);
+        return iter;
+    }
+    iter->prefijo = strdup(prefijo);
+    if (!iter->prefijo) {
+        abb_iter_in_destruir(iter);
+        return NULL;
+    }
+    iter->largo_prefijo = strlen(prefijo);
+    /* La primera clave con el prefijo es la menor mayor o igual al prefijo */
+    apilar_desde(iter->pila, arbol, prefijo);
 	return iter;
 }
 
 bool abb_iter_in_avanzar(abb_iter_t *iter)
 {
+    uint32_t actual;
+
 	if (abb_iter_in_al_final(iter))	{
 		return false;
 	}
-	pila_desapilar(iter->pila);
+	actual = (uint32_t) (uintptr_t) pila_desapilar(iter->pila);
+    apilar_izquierdos(iter->pila, iter->arbol, iter->arbol->nodos[actual].der);
+    iter->restantes--;
 	return true;
 }
 
 const char *abb_iter_in_ver_actual(const abb_iter_t *iter)
 {
-    abb_nodo_t *tope;
-
     if (abb_iter_in_al_final(iter)) {
 		return NULL;
 	}
-	tope = pila_ver_tope(iter->pila);
-	return tope->clave;
+	return nodo_clave(iter->arbol, tope_nodo(iter->pila));
 }
 
 bool abb_iter_in_al_final(const abb_iter_t *iter)
 {
-	return pila_esta_vacia(iter->pila);
+	if (pila_esta_vacia(iter->pila) || !iter->restantes) {
+        return true;
+    }
+    if (!iter->prefijo) {
+        return false;
+    }
+    /* Las claves con el prefijo son contiguas: la primera que no lo tiene es el final */
+    return strncmp(nodo_clave(iter->arbol, tope_nodo(iter->pila)), iter->prefijo, iter->largo_prefijo) != 0;
 }
 
 void abb_iter_in_destruir(abb_iter_t *iter)
 {
     if (!iter) return;
 	pila_destruir(iter->pila);
+    free(iter->prefijo);
 	free(iter);
 }
+
+/* *****************************************************************
+ *                 Primitivas del ABB congelado                    *
+ * *****************************************************************/
+
+abb_congelado_t *abb_congelar(const abb_t *arbol)
+{
+    abb_congelado_t *congelado;
+    uint32_t *orden;
+    size_t n = 0;
+    size_t i = 0;
+    size_t bytes = 0;
+
+    /* En archivo los datos están en el mapeo, que se mueve o se reusa al modificar */
+    if (arbol->archivo) {
+        return NULL;
+    }
+    congelado = malloc(sizeof(abb_congelado_t));
+    if (!congelado) {
+        return NULL;
+    }
+    congelado->cantidad = arbol->cantidad;
+    congelado->cmp = arbol->cmp;
+    congelado->claves = malloc((arbol->cantidad + 1) * sizeof(char *));
+    congelado->datos = malloc((arbol->cantidad + 1) * sizeof(void *));
+    congelado->texto = malloc(arbol->claves_usado - arbol->claves_basura + 1);
+    orden = malloc((arbol->cantidad + 1) * sizeof(uint32_t));
+    if (!congelado->claves || !congelado->datos || !congelado->texto || !orden) {
+        free(orden);
+        abb_congelado_destruir(congelado);
+        return NULL;
+    }
+    volcar_nodos(arbol, arbol->raiz, orden, &n);
+    congelado_ubicar(congelado, arbol, orden, 1, &i);
+    free(orden);
+
+    /* Copio las claves en orden de posición, para que cada nivel quede contiguo */
+    for (size_t k = 1; k <= congelado->cantidad; k++) {
+        size_t largo = strlen(congelado->claves[k]) + 1;
+        memcpy(congelado->texto + bytes, congelado->claves[k], largo);
+        congelado->claves[k] = congelado->texto + bytes;
+        bytes += largo;
+    }
+    return congelado;
+}
+
+void *abb_congelado_obtener(const abb_congelado_t *congelado, const char *clave)
+{
+    size_t k = congelado_cota_inferior(congelado, clave);
+
+    if (!k || congelado->cmp(congelado->claves[k], clave) != 0)
+        return NULL;
+    else
+        return congelado->datos[k];
+}
+
+bool abb_congelado_pertenece(const abb_congelado_t *congelado, const char *clave)
+{
+    size_t k = congelado_cota_inferior(congelado, clave);
+
+    return k && congelado->cmp(congelado->claves[k], clave) == 0;
+}
+
+size_t abb_congelado_cantidad(const abb_congelado_t *congelado)
+{
+    return congelado->cantidad;
+}
+
+void abb_congelado_in_order(const abb_congelado_t *congelado, bool visitar(const char *, void *, void *), void *extra)
+{
+    abb_congelado_rango(congelado, NULL, NULL, visitar, extra);
+}
+
+void abb_congelado_rango(const abb_congelado_t *congelado, const char *desde, const char *hasta,
+                         bool visitar(const char *, void *, void *), void *extra)
+{
+    size_t k = desde ? congelado_cota_inferior(congelado, desde) : congelado_primero(congelado);
+
+    for (; k; k = congelado_siguiente(congelado, k)) {
+        if (hasta && congelado->cmp(congelado->claves[k], hasta) > 0) {
+            return;
+        }
+        if (!visitar(congelado->claves[k], congelado->datos[k], extra)) {
+            return;
+        }
+    }
+}
+
+void abb_congelado_destruir(abb_congelado_t *congelado)
+{
+    if (!congelado) return;
+    free(congelado->claves);
+    free(congelado->datos);
+    free(congelado->texto);
+    free(congelado);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* *****************************************************************
  *                 Definición estructura de datos                  *
@@ -14,8 +15,62 @@ typedef int (*abb_comparar_clave_t) (const char *, const char *);
 
 typedef void (*abb_destruir_dato_t) (void *);
 
+// Devuelve una copia del dato, para abb_clonar.
+typedef void *(*abb_copiar_dato_t) (const void *dato);
+
+// Escribe los bytes del dato en buffer y devuelve cuántos son. Si no entran en
+// capacidad bytes, no escribe nada y devuelve los bytes que necesita.
+typedef size_t (*abb_serializar_dato_t) (const void *dato, void *buffer, size_t capacidad);
+
+// Crea un dato a partir de los bytes que escribió la función de serializar.
+typedef void *(*abb_deserializar_dato_t) (const void *bytes, size_t largo);
+
 typedef struct abb_iter abb_iter_t;
 
+typedef struct abb_congelado abb_congelado_t;
+
+/* Operación de un lote aplicado con abb_aplicar_lote */
+typedef enum abb_tipo_operacion {
+    ABB_GUARDAR,
+    ABB_BORRAR
+} abb_tipo_operacion_t;
+
+typedef struct abb_operacion {
+    abb_tipo_operacion_t tipo;
+    const char *clave;
+    void *dato;         // Al guardar, el dato nuevo. Al borrar, se completa con el dato borrado
+} abb_operacion_t;
+
+/* Par clave-dato que entrega el iterador interno por tandas */
+typedef struct abb_par {
+    const char *clave;
+    void *dato;
+} abb_par_t;
+
+/* Agregado asociativo que el ABB mantiene por subárbol: valor lleva cada dato
+ * a un número y combinar junta dos resultados, con identidad como neutro. Por
+ * ejemplo, para sumar tamaños: identidad 0, combinar la suma y valor el tamaño.
+ * combinar tiene que ser asociativa; no hace falta que sea conmutativa, se
+ * aplica siempre en el orden de las claves */
+typedef struct abb_agregado {
+    int64_t identidad;
+    int64_t (*combinar) (int64_t, int64_t);
+    int64_t (*valor) (const void *dato);
+} abb_agregado_t;
+
+/* Uso de memoria del ABB. Los bytes incluyen la capacidad reservada y no usada */
+typedef struct abb_estadisticas {
+    size_t cantidad;        // Cantidad de elementos
+    size_t bytes_nodos;     // Arreglo de nodos (en archivo, con sus datos)
+    size_t bytes_claves;    // Arreglo donde se copian las claves
+    size_t bytes_cache;     // Marcas de uso del modo caché
+    size_t bytes_vencimientos;  // Vencimientos por nodo y cola de vencimientos
+    size_t bytes_indice;    // Índice de hash
+    size_t bytes_agregados; // Agregado de cada subárbol
+    size_t bytes_filtro;    // Filtro de claves ausentes
+    size_t bytes_totales;   // Todo lo anterior más la estructura del ABB
+} abb_estadisticas_t;
+
 /* *****************************************************************
  *                 Primitivas del ABB                              *
  * *****************************************************************/
@@ -25,13 +80,80 @@ typedef struct abb_iter abb_iter_t;
 // Post: devuelve un ABB vacío con su funcion de comparar y de destrucción de dato
 abb_t* abb_crear(abb_comparar_clave_t cmp, abb_destruir_dato_t destruir_dato);
 
+// Crea un ABB en modo caché: cuando al guardar se supera la cantidad máxima de
+// elementos o los bytes máximos (nodo y clave de cada elemento), se desalojan
+// elementos poco usados aplicándoles destruir_dato, con una aproximación de LRU
+// (algoritmo del reloj). Guardar, abb_obtener y abb_pertenece marcan al
+// elemento como usado, y el desalojo les da una segunda oportunidad a unos
+// pocos marcados antes de desalojar al siguiente aunque esté marcado, así su
+// costo no depende de la cantidad de elementos. La marca modifica el ABB
+// aunque abb_obtener y abb_pertenece lo reciban const: se escribe sin lock y
+// de forma atómica, así que varios hilos pueden leer a la vez, pero no a la
+// vez que otro guarda o borra. Un límite en 0 no se controla. En caso de
+// error devuelve NULL.
+// Pre: la funcion cmp no puede ser NULL.
+// Post: devuelve un ABB vacío en modo caché.
+abb_t *abb_crear_cache(abb_comparar_clave_t cmp, abb_destruir_dato_t destruir_dato,
+                       size_t max_cantidad, size_t max_bytes);
+
+// Crea un ABB que mantiene el agregado dado para cada subárbol al guardar y
+// borrar, para poder consultarlo por rangos con abb_agregar_rango. Es
+// abb_crear seguido de abb_mantener_agregado. En caso de error devuelve NULL.
+// Pre: la funcion cmp no puede ser NULL y agregado tiene sus funciones.
+// Post: devuelve un ABB vacío con el agregado dado.
+abb_t *abb_crear_agregado(abb_comparar_clave_t cmp, abb_destruir_dato_t destruir_dato,
+                          const abb_agregado_t *agregado);
+
+// Hace que el ABB mantenga el agregado dado para cada subárbol al guardar y
+// borrar, para poder consultarlo por rangos con abb_agregar_rango. Se puede
+// agregar a un ABB con elementos (lo calcula para todos, en O(n)) y a uno en
+// modo caché. valor se llama con cada dato que se guarda; si un dato guardado
+// cambia, hay que volver a guardarlo para que el agregado se actualice.
+// Pre: el ABB fue creado y agregado tiene sus funciones.
+// Post: devuelve true si el ABB quedó con el agregado, o false si no hubo
+// memoria, ya tenía uno o está en archivo.
+bool abb_mantener_agregado(abb_t *arbol, const abb_agregado_t *agregado);
+
 // Almacena un dato en el ABB. Si ya se encuentra la clave, se reemplaza
-// con el dato nuevo y se libera el viejo.
+// con el dato nuevo y se libera el viejo. Las claves se copian a un arreglo
+// del ABB que se direcciona con desplazamientos de 32 bits: entre todas, con
+// su '\0', no pueden ocupar más de 4 GiB (los datos no cuentan). Pasado
+// ese límite, guardar una clave nueva devuelve false aunque haya memoria,
+// hasta que se borren claves suficientes.
 // Pre: el ABB fue creado, clave es distinto de NULL.
-// Post: devuelve true al almacenar con éxito, o false en caso de error.
+// Post: devuelve true al almacenar con éxito, o false si no hubo memoria o
+// si las claves ya ocupan el máximo.
 bool abb_guardar(abb_t *arbol, const char *clave, void *dato);
 
-// Borra la clave almacenada en el ABB y devuelve el dato almacenado.
+// Almacena un dato en el ABB que vence a los ttl_ms milisegundos. Una vez
+// vencido, abb_obtener, abb_pertenece y abb_borrar se comportan como si la clave
+// no perteneciera, aunque el elemento sigue ocupando lugar (y contando en
+// abb_cantidad y en los iteradores) hasta que lo saque abb_expirar. Guardar la
+// clave de nuevo reemplaza también su vencimiento. La bitácora registra el
+// vencimiento como un instante del reloj de pared: al reproducirla, el
+// elemento vuelve con el tiempo que le quedaba, o no vuelve si ya venció.
+// Pre: el ABB fue creado, clave es distinto de NULL.
+// Post: devuelve true al almacenar con éxito, o false en caso de error.
+bool abb_guardar_con_ttl(abb_t *arbol, const char *clave, void *dato, size_t ttl_ms);
+
+// Aplica un lote de operaciones de guardar y borrar: se reparten entre los
+// subárboles a medida que se baja, así los caminos compartidos por claves
+// vecinas se recorren una sola vez, y las claves nuevas de un mismo hueco se
+// enganchan como un subárbol balanceado. Si el ABB queda demasiado alto se
+// rebalancea entero, pero a lo sumo una vez cada tantos nodos recorridos y
+// operaciones aplicadas por lotes como elementos tiene, así que rebalancear a
+// lo sumo duplica el costo de los lotes. En cada operación de borrar, dato
+// queda con el dato borrado, o NULL si la clave no pertenecía.
+// Pre: el ABB fue creado, las operaciones están ordenadas según la función de
+// comparar, sin claves repetidas, y sus claves no son claves del propio ABB.
+// Post: devuelve true si se aplicaron todas las operaciones, o false si no hubo
+// memoria, en cuyo caso no se aplicó ninguna.
+bool abb_aplicar_lote(abb_t *arbol, abb_operacion_t *operaciones, size_t cantidad);
+
+// Borra la clave almacenada en el ABB y devuelve el dato almacenado. En
+// archivo, si no hay lugar para copiar los nodos que toca el borrado, la
+// clave no se borra, se devuelve NULL y abb_archivo_sincronizar informa el
+// error; con abb_pertenece se distingue de una clave que no estaba.
 // Pre: el ABB fue creado, clave es distinto de NULL.
 // Post: devuelve el dato almacenado o NULL si la clave no pertenece.
 void *abb_borrar(abb_t *arbol, const char *clave);
@@ -50,10 +172,129 @@ bool abb_pertenece(const abb_t *arbol, const char *clave);
 // Post: devuelve la cantidad de elementos del ABB.
 size_t abb_cantidad(abb_t *arbol);
 
-// Destruye el ABB
+// Devuelve el agregado de los datos con clave entre desde y hasta, inclusive,
+// combinados en orden. Si desde o hasta es NULL, el rango no tiene cota de ese
+// lado. Si no hay datos en el rango devuelve la identidad. Tarda O(altura del
+// ABB), sin importar cuántos elementos haya en el rango. El ABB no se
+// balancea solo: con claves al azar la altura es O(log n), pero con claves
+// guardadas en orden puede llegar a O(n). Los elementos vencidos que todavía
+// no se sacaron se cuentan.
+// Pre: el ABB mantiene un agregado (abb_crear_agregado o abb_mantener_agregado).
+int64_t abb_agregar_rango(const abb_t *arbol, const char *desde, const char *hasta);
+
+// Crea una copia del ABB con la misma forma, sin comparar claves: copia de una
+// vez los bloques de nodos y de claves, y también el modo caché, los
+// vencimientos, los agregados y el índice de hash si los tiene. A cada dato lo
+// copia con copiar_dato; si copiar_dato es NULL los datos se comparten y el
+// clon queda sin función de destrucción: los destruye solo el original, así
+// que el clon no puede usarse después de destruir el original, y lo que se
+// guarde en el clon no se destruye nunca. Si copiar_dato devuelve NULL para un
+// dato que no lo es, se destruyen las copias ya hechas y se devuelve NULL. La
+// copia no tiene bitácora. En caso de error devuelve NULL.
+// Pre: el ABB fue creado.
+// Post: devuelve un ABB nuevo con los mismos elementos que el original.
+abb_t *abb_clonar(const abb_t *arbol, abb_copiar_dato_t copiar_dato);
+
+// Agrega al ABB un índice de hash de las claves, que se mantiene al guardar y
+// borrar. Con el índice, abb_obtener y abb_pertenece responden en O(1) sin
+// recorrer el ABB; los recorridos y rangos siguen usando el ABB.
+// Pre: el ABB fue creado y su función de comparar devuelve 0 solo para
+// claves idénticas byte a byte.
+// Post: devuelve true si el ABB quedó indexado, o false si no hubo memoria.
+bool abb_indexar(abb_t *arbol);
+
+// Agrega al ABB un filtro de Bloom con contadores, que se mantiene al guardar
+// y borrar. abb_obtener y abb_pertenece rechazan con él casi todas las claves
+// que no están leyendo una sola línea de caché, sin recorrer el ABB. De las
+// claves ausentes, a lo sumo una fracción cercana a tasa_falsos_positivos
+// pasa el filtro. Está dimensionado para capacidad claves y se rehace con el
+// doble cuando el ABB las supera.
+// Pre: el ABB fue creado, 0 < tasa_falsos_positivos < 1 y su función de
+// comparar devuelve 0 solo para claves idénticas byte a byte.
+// Post: devuelve true si el ABB quedó con el filtro, o false si no hubo
+// memoria, la tasa no es válida o ya tenía uno.
+bool abb_filtrar(abb_t *arbol, size_t capacidad, double tasa_falsos_positivos);
+
+// Saca del ABB elementos vencidos, aplicándoles destruir_dato, mirando como
+// mucho max_trabajo entradas de la cola de vencimientos. El trabajo es
+// proporcional a los elementos vencidos, no al tamaño del ABB.
+// Pre: el ABB fue creado.
+// Post: devuelve la cantidad de elementos que sacó.
+size_t abb_expirar(abb_t *arbol, size_t max_trabajo);
+
+// Completa las estadísticas de uso de memoria del ABB.
+// Pre: el ABB fue creado.
+// Post: estadisticas contiene la cantidad de elementos y los bytes que ocupa el ABB.
+void abb_estadisticas(const abb_t *arbol, abb_estadisticas_t *estadisticas);
+
+// Engancha al ABB una bitácora en el archivo dado, donde se registra cada
+// abb_guardar y abb_borrar. Si el archivo ya existe, primero se reproducen sus
+// registros sobre el ABB. Los registros se bajan a disco en grupo: un fsync
+// cada lote registros, o en el primer registro que llega pasados unos
+// milisegundos del primero pendiente. Ese plazo solo se mira al registrar: que
+// abb_guardar o abb_borrar vuelvan no garantiza que la modificación sobreviva
+// a una caída, y si no llegan más registros los pendientes esperan hasta
+// abb_bitacora_sincronizar. Cuando el archivo crece lo suficiente, se
+// reemplaza por una imagen del contenido.
+// Si serializar es NULL los datos no se registran y se reproducen como NULL.
+// Pre: el ABB fue creado, está vacío y no tiene bitácora.
+// Post: devuelve true si la bitácora quedó enganchada, o false en caso de error.
+bool abb_bitacora_abrir(abb_t *arbol, const char *ruta, abb_serializar_dato_t serializar,
+                        abb_deserializar_dato_t deserializar, size_t lote);
+
+// Baja a disco los registros pendientes de la bitácora. Al volver, todas las
+// modificaciones anteriores sobreviven a una caída.
+// Pre: el ABB fue creado.
+// Post: devuelve false si hubo algún error de escritura en la bitácora, o
+// alguna modificación que no se pudo registrar.
+bool abb_bitacora_sincronizar(abb_t *arbol);
+
+// Abre el ABB guardado en el archivo dado (y en otros dos con los sufijos
+// ".claves" y ".datos"), creándolo vacío si no existe. Los nodos, las claves
+// y los datos viven en los archivos mapeados en memoria, así que abrirlo no
+// depende de cuántos elementos tenga. Cada dato son tam_dato bytes que se
+// copian al archivo desde el puntero que recibe abb_guardar, que puede ser
+// uno devuelto por abb_obtener; abb_obtener y los iteradores devuelven un
+// puntero dentro del archivo, válido hasta la próxima modificación. Los datos
+// van en su propio archivo, según el número de nodo, así que el límite de
+// 4 GiB de abb_guardar es solo para las claves. Las modificaciones copian los
+// nodos que tocan en vez de pisarlos, así que si el programa se cae el ABB
+// vuelve al último punto de control. El lugar de lo borrado se reusa después
+// del siguiente punto de control; si se acumula mucho sin sincronizar, se
+// escribe uno solo. En archivo no hay vencimientos, índice, filtro, bitácora,
+// clonado ni congelado, y las claves no se compactan.
+// Pre: cmp es la misma función de comparar con la que se guardó el archivo.
+// Post: devuelve el ABB, o NULL en caso de error, si el archivo no es válido
+// o si se guardó con otro tam_dato.
+abb_t *abb_abrir_archivo(const char *ruta, abb_comparar_clave_t cmp, size_t tam_dato);
+
+// Escribe un punto de control del ABB en archivo: al volver, todas las
+// modificaciones anteriores sobreviven a una caída. En un ABB que no está en
+// archivo no hace nada.
+// Pre: el ABB fue creado.
+// Post: devuelve false si hubo algún error de escritura, o si algún
+// abb_borrar no se pudo hacer por falta de lugar.
+bool abb_archivo_sincronizar(abb_t *arbol);
+
+// Destruye el ABB. Si tiene bitácora, la sincroniza y la cierra. Si está en
+// archivo, escribe un punto de control y lo cierra.
 // Post: el ABB fue destruido.
 void abb_destruir(abb_t *arbol);
 
+// Destruye el ABB en segundo plano: lo saca de circulación y vuelve enseguida,
+// sin importar cuántos elementos tenga. Los nodos y los datos se liberan por
+// tandas en un hilo aparte, así que destruir_dato tiene que poder llamarse
+// desde otro hilo. Si tiene bitácora, la sincroniza y la cierra antes de volver.
+// Pre: el ABB fue creado y no se vuelve a usar, ni él ni sus iteradores.
+// Post: el ABB va a ser destruido.
+void abb_destruir_diferido(abb_t *arbol);
+
+// Espera a que terminen todas las destrucciones diferidas y termina el hilo
+// que las hace. Pensada para el cierre del programa.
+// Pre: no se llama a la vez que abb_destruir_diferido desde otro hilo.
+// Post: todos los ABB pasados a abb_destruir_diferido fueron destruidos.
+void abb_esperar_destrucciones(void);
+
 /* *****************************************************************
  *                 Primitivas del iterador interno                 *
  * *****************************************************************/
@@ -63,15 +304,43 @@ void abb_destruir(abb_t *arbol);
 // hasta que se termine o hasta que visitar devuelva false.
 void abb_in_order(abb_t *arbol, bool visitar(const char *, void *, void *), void *extra);
 
+// Recorre los elementos en in-order, juntándolos de a capacidad pares en el
+// buffer recibido y llamando a visitar una vez por tanda con los pares juntados.
+// La última tanda puede tener menos pares. Las claves son válidas hasta la
+// próxima modificación del ABB.
+// Pre: el ABB fue creado, buffer tiene lugar para capacidad pares, capacidad es
+// mayor a cero y visitar debe ser válida.
+// Post: recorre cada uno de los elementos del ABB hasta que se termine o hasta
+// que visitar devuelva false. Devuelve false si no pudo pedir memoria.
+bool abb_in_order_lote(abb_t *arbol, abb_par_t *buffer, size_t capacidad,
+                       bool visitar(abb_par_t *, size_t, void *), void *extra);
+
+// Devuelve la cantidad de claves que empiezan con el prefijo dado. Recorre
+// solo las ramas que pueden tener esas claves.
+// Pre: el ABB fue creado, prefijo es distinto de NULL y la función de comparar
+// ordena las claves como strcmp.
+size_t abb_contar_prefijo(const abb_t *arbol, const char *prefijo);
+
 /* *****************************************************************
  *                 Primitivas del iterador externo                 *
  * *****************************************************************/
 
-// Crea un iterador in-order del ABB.
+// Crea un iterador in-order del ABB. Si después se modifica el ABB, el
+// iterador deja de ser válido y solo se puede destruir.
 // Pre: el ABB fue creado.
 // Post: devuelve un iterador situado en el primer elemento.
 abb_iter_t *abb_iter_in_crear(const abb_t *arbol);
 
+// Crea un iterador in-order que recorre solo las claves que empiezan con el
+// prefijo dado, y como mucho limite de ellas (sin límite si es 0). Busca la
+// primera clave sin recorrer las anteriores y termina en la primera que no
+// tiene el prefijo. Se usa con las mismas primitivas del iterador in-order.
+// Pre: el ABB fue creado, prefijo es distinto de NULL y la función de comparar
+// ordena las claves como strcmp.
+// Post: devuelve un iterador situado en la primera clave con el prefijo,
+// o NULL en caso de error.
+abb_iter_t *abb_iter_prefijo_crear(const abb_t *arbol, const char *prefijo, size_t limite);
+
 // Avanza el iterador al siguiente elemento del ABB según in-order.
 // Devuelve verdadero en caso de que pueda avanzar y falso en caso contrario.
 // Pre: el iterador fue creado.
@@ -79,6 +348,7 @@ abb_iter_t *abb_iter_in_crear(const abb_t *arbol);
 bool abb_iter_in_avanzar(abb_iter_t *iter);
 
 // Devuelve la clave del elemento donde está situado el iterador.
+// La clave es válida hasta la próxima modificación del ABB.
 // Pre: el iterador fue creado.
 // Post: devuelve la clave de la posición actual o NULL si el iterador está al final.
 const char *abb_iter_in_ver_actual(const abb_iter_t *iter);
@@ -92,6 +362,48 @@ bool abb_iter_in_al_final(const abb_iter_t *iter);
 // Post: el iterador fue destruido.
 void abb_iter_in_destruir(abb_iter_t* iter);
 
+/* *****************************************************************
+ *                 Primitivas del ABB congelado                    *
+ * *****************************************************************/
+
+// Crea una copia inmutable del contenido actual del ABB, guardada en un
+// arreglo implícito (orden de Eytzinger) para búsquedas con menos fallos de
+// caché. Los datos siguen perteneciendo al ABB: la copia no los destruye.
+// En caso de que no la pueda crear, o si el ABB está en archivo, devuelve NULL.
+// Pre: el ABB fue creado.
+// Post: devuelve un ABB congelado con los mismos pares clave-dato.
+abb_congelado_t *abb_congelar(const abb_t *arbol);
+
+// Devuelve el dato almacenado con la clave recibida.
+// Pre: el ABB congelado fue creado, clave es distinto de NULL.
+// Post: devuelve el dato almacenado, o devuelve NULL si la clave no pertenece.
+void *abb_congelado_obtener(const abb_congelado_t *congelado, const char *clave);
+
+// Devuelve true si la clave provista pertenece al ABB congelado.
+// Pre: el ABB congelado fue creado, clave es distinto de NULL.
+bool abb_congelado_pertenece(const abb_congelado_t *congelado, const char *clave);
+
+// Pre: el ABB congelado fue creado.
+// Post: devuelve la cantidad de elementos del ABB congelado.
+size_t abb_congelado_cantidad(const abb_congelado_t *congelado);
+
+// Pre: el ABB congelado fue creado y visitar debe ser válida.
+// Post: recorre en orden cada uno de los elementos
+// hasta que se termine o hasta que visitar devuelva false.
+void abb_congelado_in_order(const abb_congelado_t *congelado, bool visitar(const char *, void *, void *), void *extra);
+
+// Recorre en orden los elementos con clave entre desde y hasta, inclusive.
+// Si desde o hasta es NULL, el rango no tiene cota de ese lado.
+// Pre: el ABB congelado fue creado y visitar debe ser válida.
+// Post: recorre los elementos del rango hasta que se termine o hasta que
+// visitar devuelva false.
+void abb_congelado_rango(const abb_congelado_t *congelado, const char *desde, const char *hasta,
+                         bool visitar(const char *, void *, void *), void *extra);
+
+// Destruye el ABB congelado. No destruye los datos.
+// Post: el ABB congelado fue destruido.
+void abb_congelado_destruir(abb_congelado_t *congelado);
+
 /* *****************************************************************
  *                 Pruebas de la implementación                    *
  * *****************************************************************/
@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archivo.h"
+
+#define PAGINA 4096                 // Lo que ocupa el encabezado al comienzo del archivo de nodos
+#define COPIA_DESPLAZAMIENTO 2048   // Distancia entre las dos copias del encabezado, en sectores distintos
+#define MAGICO "ABBARCH3"           // Primeros bytes de cada copia del encabezado
+#define LARGO_MAGICO 8
+#define SUFIJO_CLAVES ".claves"
+#define SUFIJO_DATOS ".datos"
+
+/* Cada copia del encabezado es el número mágico, el encabezado y una suma de
+ * verificación de lo anterior. La copia vale si coinciden el mágico y la suma */
+typedef struct copia_encabezado {
+    char magico[LARGO_MAGICO];
+    archivo_encabezado_t encabezado;
+    uint64_t suma;
+} copia_encabezado_t;
+
+struct archivo {
+    int fd_nodos;
+    int fd_claves;
+    int fd_datos;
+    char *nodos;            // Mapa del archivo de nodos, encabezado incluido
+    size_t largo_nodos;
+    char *claves;
+    size_t largo_claves;
+    char *datos;
+    size_t largo_datos;
+    uint64_t secuencia;     // Secuencia del último encabezado escrito
+};
+
+/* *****************************************************************
+ *                    Funciones auxiliares                         *
+ * *****************************************************************/
+
+/* Suma de verificación de los bytes dados (FNV-1a) */
+static uint64_t sumar(const void *bytes, size_t largo)
+{
+    const unsigned char *b = bytes;
+    uint64_t suma = 0xcbf29ce484222325u;
+
+    for (size_t i = 0; i < largo; i++) {
+        suma = (suma ^ b[i]) * 0x100000001b3u;
+    }
+    return suma;
+}
+
+/* Lee la copia del encabezado que está en el desplazamiento dado. Devuelve
+ * false si no es válida */
+static bool leer_copia(const archivo_t *archivo, size_t desplazamiento, archivo_encabezado_t *encabezado)
+{
+    copia_encabezado_t copia;
+
+    memcpy(&copia, archivo->nodos + desplazamiento, sizeof(copia));
+    if (memcmp(copia.magico, MAGICO, LARGO_MAGICO) != 0
+        || copia.suma != sumar(&copia, offsetof(copia_encabezado_t, suma))) {
+        return false;
+    }
+    *encabezado = copia.encabezado;
+    return true;
+}
+
+/* Abre, creándolo si no existe, el archivo de la ruta con el sufijo dado.
+ * Devuelve su descriptor, o -1 en caso de error */
+static int abrir_con_sufijo(const char *ruta, const char *sufijo)
+{
+    size_t largo = strlen(ruta), largo_sufijo = strlen(sufijo);
+    char *completa = malloc(largo + largo_sufijo + 1);
+    int fd;
+
+    if (!completa) {
+        return -1;
+    }
+    memcpy(completa, ruta, largo);
+    memcpy(completa + largo, sufijo, largo_sufijo + 1);
+    fd = open(completa, O_RDWR | O_CREAT, 0644);
+    free(completa);
+    return fd;
+}
+
+/* Devuelve el largo con el que se mapea un archivo del tamaño dado: al menos una página */
+static size_t largo_mapa(const struct stat *info)
+{
+    return (size_t) info->st_size > PAGINA ? (size_t) info->st_size : PAGINA;
+}
+
+/* Mapea largo bytes del archivo, agrandándolo antes si es más chico. Si falla
+ * devuelve NULL */
+static char *mapear(int fd, size_t largo)
+{
+    struct stat info;
+    void *mapa;
+
+    if (fstat(fd, &info) < 0 || ((size_t) info.st_size < largo && ftruncate(fd, (off_t) largo) < 0)) {
+        return NULL;
+    }
+    mapa = mmap(NULL, largo, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return mapa == MAP_FAILED ? NULL : mapa;
+}
+
+/* Vuelve a mapear el archivo con el largo nuevo. Si falla deja el mapa como estaba */
+static bool agrandar(int fd, char **mapa, size_t *largo, size_t nuevo)
+{
+    char *nuevo_mapa;
+
+    if (nuevo <= *largo) {
+        return true;
+    }
+    nuevo_mapa = mapear(fd, nuevo);
+    if (!nuevo_mapa) {
+        return false;
+    }
+    munmap(*mapa, *largo);
+    *mapa = nuevo_mapa;
+    *largo = nuevo;
+    return true;
+}
+
+/* Espera a que el mapa y el largo del archivo estén en disco */
+static bool bajar(int fd, char *mapa, size_t largo)
+{
+    return msync(mapa, largo, MS_SYNC) == 0 && fdatasync(fd) == 0;
+}
+
+/* *****************************************************************
+ *                    Primitivas del archivo                       *
+ * *****************************************************************/
+
+archivo_t *archivo_abrir(const char *ruta, archivo_encabezado_t *encabezado)
+{
+    archivo_t *archivo = malloc(sizeof(archivo_t));
+    struct stat nodos, claves, datos;
+    archivo_encabezado_t otro;
+    bool valido, otro_valido;
+
+    if (!archivo) {
+        return NULL;
+    }
+    archivo->nodos = NULL;
+    archivo->claves = NULL;
+    archivo->datos = NULL;
+    archivo->fd_nodos = open(ruta, O_RDWR | O_CREAT, 0644);
+    archivo->fd_claves = abrir_con_sufijo(ruta, SUFIJO_CLAVES);
+    archivo->fd_datos = abrir_con_sufijo(ruta, SUFIJO_DATOS);
+    if (archivo->fd_nodos < 0 || archivo->fd_claves < 0 || archivo->fd_datos < 0
+        || fstat(archivo->fd_nodos, &nodos) < 0 || fstat(archivo->fd_claves, &claves) < 0
+        || fstat(archivo->fd_datos, &datos) < 0) {
+        archivo_cerrar(archivo);
+        return NULL;
+    }
+
+    /* El archivo de nodos tiene al menos la página del encabezado */
+    archivo->largo_nodos = largo_mapa(&nodos);
+    archivo->largo_claves = largo_mapa(&claves);
+    archivo->largo_datos = largo_mapa(&datos);
+    archivo->nodos = mapear(archivo->fd_nodos, archivo->largo_nodos);
+    archivo->claves = mapear(archivo->fd_claves, archivo->largo_claves);
+    archivo->datos = mapear(archivo->fd_datos, archivo->largo_datos);
+    if (!archivo->nodos || !archivo->claves || !archivo->datos) {
+        archivo_cerrar(archivo);
+        return NULL;
+    }
+
+    /* Me quedo con la copia válida de secuencia más alta */
+    valido = leer_copia(archivo, 0, encabezado);
+    otro_valido = leer_copia(archivo, COPIA_DESPLAZAMIENTO, &otro);
+    if (otro_valido && (!valido || otro.secuencia > encabezado->secuencia)) {
+        *encabezado = otro;
+        valido = true;
+    }
+    if (!valido) {
+        /* Si nunca se escribió un encabezado, el archivo es nuevo (o se cayó
+         * antes del primer punto de control, que es lo mismo) */
+        if (memcmp(archivo->nodos, MAGICO, LARGO_MAGICO) == 0
+            || memcmp(archivo->nodos + COPIA_DESPLAZAMIENTO, MAGICO, LARGO_MAGICO) == 0) {
+            archivo_cerrar(archivo);
+            return NULL;
+        }
+        memset(encabezado, 0, sizeof(archivo_encabezado_t));
+    }
+    archivo->secuencia = encabezado->secuencia;
+    return archivo;
+}
+
+void *archivo_nodos(const archivo_t *archivo, size_t *bytes)
+{
+    *bytes = archivo->largo_nodos - PAGINA;
+    return archivo->nodos + PAGINA;
+}
+
+char *archivo_claves(const archivo_t *archivo, size_t *bytes)
+{
+    *bytes = archivo->largo_claves;
+    return archivo->claves;
+}
+
+char *archivo_datos(const archivo_t *archivo, size_t *bytes)
+{
+    *bytes = archivo->largo_datos;
+    return archivo->datos;
+}
+
+bool archivo_agrandar_nodos(archivo_t *archivo, size_t bytes)
+{
+    return agrandar(archivo->fd_nodos, &archivo->nodos, &archivo->largo_nodos, PAGINA + bytes);
+}
+
+bool archivo_agrandar_claves(archivo_t *archivo, size_t bytes)
+{
+    return agrandar(archivo->fd_claves, &archivo->claves, &archivo->largo_claves, bytes);
+}
+
+bool archivo_agrandar_datos(archivo_t *archivo, size_t bytes)
+{
+    return agrandar(archivo->fd_datos, &archivo->datos, &archivo->largo_datos, bytes);
+}
+
+bool archivo_confirmar(archivo_t *archivo, archivo_encabezado_t *encabezado)
+{
+    copia_encabezado_t copia;
+
+    /* Todo lo que el encabezado nuevo alcanza tiene que estar en disco antes que él */
+    if (!bajar(archivo->fd_claves, archivo->claves, archivo->largo_claves)
+        || !bajar(archivo->fd_datos, archivo->datos, archivo->largo_datos)
+        || !bajar(archivo->fd_nodos, archivo->nodos, archivo->largo_nodos)) {
+        return false;
+    }
+    encabezado->secuencia = archivo->secuencia + 1;
+    memcpy(copia.magico, MAGICO, LARGO_MAGICO);
+    copia.encabezado = *encabezado;
+    copia.suma = sumar(&copia, offsetof(copia_encabezado_t, suma));
+
+    /* Piso la copia más vieja: la otra es el punto de control anterior */
+    memcpy(archivo->nodos + (encabezado->secuencia % 2) * COPIA_DESPLAZAMIENTO, &copia, sizeof(copia));
+    if (msync(archivo->nodos, PAGINA, MS_SYNC) < 0) {
+        return false;
+    }
+    archivo->secuencia = encabezado->secuencia;
+    return true;
+}
+
+void archivo_cerrar(archivo_t *archivo)
+{
+    if (!archivo) return;
+    if (archivo->nodos) {
+        munmap(archivo->nodos, archivo->largo_nodos);
+    }
+    if (archivo->claves) {
+        munmap(archivo->claves, archivo->largo_claves);
+    }
+    if (archivo->datos) {
+        munmap(archivo->datos, archivo->largo_datos);
+    }
+    if (archivo->fd_nodos >= 0) {
+        close(archivo->fd_nodos);
+    }
+    if (archivo->fd_claves >= 0) {
+        close(archivo->fd_claves);
+    }
+    if (archivo->fd_datos >= 0) {
+        close(archivo->fd_datos);
+    }
+    free(archivo);
+}
@@ -0,0 +1,80 @@
+#ifndef ARCHIVO_H
+#define ARCHIVO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* *****************************************************************
+ *                DEFINICION DE LOS TIPOS DE DATOS
+ * *****************************************************************/
+
+/* Archivos mapeados en memoria donde vive un ABB persistente: uno con el
+ * encabezado y los nodos, otro (con el sufijo ".claves") con las claves, y
+ * otro (con el sufijo ".datos") con el dato de cada nodo. El encabezado tiene dos copias; se escribe siempre la más vieja,
+ * así una caída a mitad de la escritura deja intacta la otra. */
+
+#define ARCHIVO_CLASES 56  // Clases de tamaño de los espacios libres del archivo de claves
+
+struct archivo;  // Definición completa en archivo.c.
+typedef struct archivo archivo_t;
+
+/* Estado del ABB que se guarda en el encabezado en cada punto de control */
+typedef struct archivo_encabezado {
+    uint64_t secuencia;     // 0 si el archivo es nuevo
+    uint64_t usados;
+    uint64_t cantidad;
+    uint64_t bytes;
+    uint64_t claves_usado;
+    uint64_t claves_basura;
+    uint32_t raiz;
+    uint32_t libres;        // Solo vale si limpio
+    uint32_t tam_dato;
+    uint32_t limpio;        // Si el ABB se cerró bien después de este punto de control
+    uint32_t claves_libres[ARCHIVO_CLASES]; // Listas de espacios libres por clase. Solo valen si limpio
+} archivo_encabezado_t;
+
+
+/* *****************************************************************
+ *                    PRIMITIVAS DEL ARCHIVO
+ * *****************************************************************/
+
+// Abre los archivos de la ruta dada, creándolos si no existen, y los mapea.
+// Devuelve en encabezado la copia válida más reciente, o uno en cero si los
+// archivos son nuevos.
+// Post: devuelve el archivo abierto, o NULL en caso de error o si ninguna
+// copia del encabezado es válida.
+archivo_t *archivo_abrir(const char *ruta, archivo_encabezado_t *encabezado);
+
+// Devuelve el comienzo de la zona de nodos y su largo en bytes a través de bytes.
+// Pre: el archivo fue abierto.
+void *archivo_nodos(const archivo_t *archivo, size_t *bytes);
+
+// Devuelve el comienzo de la zona de claves y su largo en bytes a través de bytes.
+// Pre: el archivo fue abierto.
+char *archivo_claves(const archivo_t *archivo, size_t *bytes);
+
+// Devuelve el comienzo de la zona de datos y su largo en bytes a través de bytes.
+// Pre: el archivo fue abierto.
+char *archivo_datos(const archivo_t *archivo, size_t *bytes);
+
+// Agranda la zona de nodos, la de claves o la de datos hasta bytes. Las zonas pueden
+// cambiar de dirección: hay que volver a pedirlas.
+// Pre: el archivo fue abierto.
+// Post: devuelve false si no se pudo agrandar; las zonas siguen como estaban.
+bool archivo_agrandar_nodos(archivo_t *archivo, size_t bytes);
+bool archivo_agrandar_claves(archivo_t *archivo, size_t bytes);
+bool archivo_agrandar_datos(archivo_t *archivo, size_t bytes);
+
+// Punto de control: espera a que las tres zonas estén en disco y recién
+// entonces escribe el encabezado, con la secuencia siguiente, y espera a que
+// también esté en disco.
+// Pre: el archivo fue abierto.
+// Post: devuelve false si no se pudo; el punto de control anterior sigue valiendo.
+bool archivo_confirmar(archivo_t *archivo, archivo_encabezado_t *encabezado);
+
+// Desmapea y cierra los archivos, sin escribir nada.
+// Post: el archivo fue cerrado.
+void archivo_cerrar(archivo_t *archivo);
+
+#endif // ARCHIVO_H
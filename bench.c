@@ -0,0 +1,367 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "abb.h"
+
+#define CANTIDAD 1000000        // Elementos del ABB
+#define BUSQUEDAS 2000000       // Búsquedas por medición
+#define LARGO_CLAVE 16
+#define ESCRITURAS 200000       // abb_guardar con bitácora
+#define LOTE 256                // Registros por fsync de la bitácora
+#define TAM_LOTE 10000          // Operaciones por lote de abb_aplicar_lote
+
+/* *****************************************************************
+ *                    Funciones auxiliares                         *
+ * *****************************************************************/
+
+/* Devuelve el tiempo actual en segundos */
+static double ahora(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/* Generador pseudoaleatorio simple, para que las mediciones sean repetibles */
+static unsigned long siguiente_azar(unsigned long *estado)
+{
+    *estado = *estado * 6364136223846793005UL + 1442695040888963407UL;
+    return *estado >> 33;
+}
+
+/* Crea CANTIDAD claves distintas en orden aleatorio */
+static char *crear_claves(void)
+{
+    char *claves = malloc((size_t) CANTIDAD * LARGO_CLAVE);
+    unsigned long estado = 42;
+
+    if (!claves) {
+        return NULL;
+    }
+    for (size_t i = 0; i < CANTIDAD; i++) {
+        snprintf(claves + i * LARGO_CLAVE, LARGO_CLAVE, "k%07zu", i);
+    }
+    /* Mezclo con Fisher-Yates */
+    for (size_t i = CANTIDAD - 1; i > 0; i--) {
+        size_t j = siguiente_azar(&estado) % (i + 1);
+        char aux[LARGO_CLAVE];
+        memcpy(aux, claves + i * LARGO_CLAVE, LARGO_CLAVE);
+        memcpy(claves + i * LARGO_CLAVE, claves + j * LARGO_CLAVE, LARGO_CLAVE);
+        memcpy(claves + j * LARGO_CLAVE, aux, LARGO_CLAVE);
+    }
+    return claves;
+}
+
+/* *****************************************************************
+ *                          Mediciones                             *
+ * *****************************************************************/
+
+static void medir_congelado(abb_t *arbol, const char *claves)
+{
+    abb_congelado_t *congelado;
+    unsigned long estado = 7;
+    size_t encontrados = 0;
+    double inicio, arbol_s, congelado_s, indexado_s;
+
+    inicio = ahora();
+    for (size_t i = 0; i < BUSQUEDAS; i++) {
+        encontrados += abb_obtener(arbol, claves + (siguiente_azar(&estado) % CANTIDAD) * LARGO_CLAVE) != NULL;
+    }
+    arbol_s = ahora() - inicio;
+
+    congelado = abb_congelar(arbol);
+    if (!congelado) {
+        return;
+    }
+    estado = 7;
+    inicio = ahora();
+    for (size_t i = 0; i < BUSQUEDAS; i++) {
+        encontrados += abb_congelado_obtener(congelado, claves + (siguiente_azar(&estado) % CANTIDAD) * LARGO_CLAVE) != NULL;
+    }
+    congelado_s = ahora() - inicio;
+    abb_congelado_destruir(congelado);
+
+    if (!abb_indexar(arbol)) {
+        return;
+    }
+    estado = 7;
+    inicio = ahora();
+    for (size_t i = 0; i < BUSQUEDAS; i++) {
+        encontrados += abb_obtener(arbol, claves + (siguiente_azar(&estado) % CANTIDAD) * LARGO_CLAVE) != NULL;
+    }
+    indexado_s = ahora() - inicio;
+
+    printf("obtener, abb:        %8.1f ns\n", arbol_s * 1e9 / BUSQUEDAS);
+    printf("obtener, congelado:  %8.1f ns (%.2fx)\n", congelado_s * 1e9 / BUSQUEDAS, arbol_s / congelado_s);
+    printf("obtener, indexado:   %8.1f ns (%.2fx)\n", indexado_s * 1e9 / BUSQUEDAS, arbol_s / indexado_s);
+    if (encontrados != 3 * (size_t) BUSQUEDAS) {
+        printf("error: faltaron claves\n");
+    }
+}
+
+/* Busca claves que no están, en un clon del ABB sin y con filtro. Cada clave
+ * ausente es una existente con una letra más, así cae en cualquier lugar del ABB */
+static void medir_filtro(const abb_t *arbol, const char *claves)
+{
+    abb_t *clon = abb_clonar(arbol, NULL);
+    char clave[LARGO_CLAVE + 1];
+    unsigned long estado = 11;
+    size_t encontrados = 0;
+    double inicio, sin_filtro_s, con_filtro_s;
+
+    if (!clon) {
+        return;
+    }
+    inicio = ahora();
+    for (size_t i = 0; i < BUSQUEDAS; i++) {
+        memcpy(clave, claves + (siguiente_azar(&estado) % CANTIDAD) * LARGO_CLAVE, LARGO_CLAVE);
+        strcat(clave, "x");
+        encontrados += abb_pertenece(clon, clave);
+    }
+    sin_filtro_s = ahora() - inicio;
+
+    estado = 11;
+    if (!abb_filtrar(clon, CANTIDAD, 0.01)) {
+        abb_destruir(clon);
+        return;
+    }
+    inicio = ahora();
+    for (size_t i = 0; i < BUSQUEDAS; i++) {
+        memcpy(clave, claves + (siguiente_azar(&estado) % CANTIDAD) * LARGO_CLAVE, LARGO_CLAVE);
+        strcat(clave, "x");
+        encontrados += abb_pertenece(clon, clave);
+    }
+    con_filtro_s = ahora() - inicio;
+    abb_destruir(clon);
+
+    printf("pertenece ausente, abb:     %8.1f ns\n", sin_filtro_s * 1e9 / BUSQUEDAS);
+    printf("pertenece ausente, filtro:  %8.1f ns (%.2fx)\n", con_filtro_s * 1e9 / BUSQUEDAS,
+           sin_filtro_s / con_filtro_s);
+    if (encontrados) {
+        printf("error: aparecieron claves ausentes\n");
+    }
+}
+
+/* Serializa el dato como la clave a la que apunta */
+static size_t serializar_clave(const void *dato, void *buffer, size_t capacidad)
+{
+    if (capacidad >= LARGO_CLAVE) {
+        memcpy(buffer, dato, LARGO_CLAVE);
+    }
+    return LARGO_CLAVE;
+}
+
+static void medir_bitacora(const char *claves)
+{
+    char ruta[64];
+    abb_t *arbol = abb_crear(strcmp, NULL);
+    double inicio, segundos;
+
+    snprintf(ruta, sizeof(ruta), "/tmp/abb_bench_%d", (int) getpid());
+    unlink(ruta);
+    if (!arbol || !abb_bitacora_abrir(arbol, ruta, serializar_clave, NULL, LOTE)) {
+        abb_destruir(arbol);
+        return;
+    }
+    inicio = ahora();
+    for (size_t i = 0; i < ESCRITURAS; i++) {
+        abb_guardar(arbol, claves + i * LARGO_CLAVE, (void *) (claves + i * LARGO_CLAVE));
+    }
+    abb_bitacora_sincronizar(arbol);
+    segundos = ahora() - inicio;
+    printf("guardar con bitacora (lote %d): %8.0f escrituras/s\n", LOTE, ESCRITURAS / segundos);
+    abb_destruir(arbol);
+    unlink(ruta);
+}
+
+/* Compara dos operaciones por su clave, para qsort */
+static int comparar_operaciones(const void *a, const void *b)
+{
+    return strcmp(((const abb_operacion_t *) a)->clave, ((const abb_operacion_t *) b)->clave);
+}
+
+/* Parte de dos ABB con la primera mitad de las claves y les guarda la otra
+ * mitad en lotes ordenados: a uno clave por clave, al otro con abb_aplicar_lote */
+static void medir_lote(const char *claves)
+{
+    abb_operacion_t *operaciones = malloc(TAM_LOTE * sizeof(abb_operacion_t));
+    abb_t *uno_a_uno = abb_crear(strcmp, NULL);
+    abb_t *por_lote = abb_crear(strcmp, NULL);
+    double uno_a_uno_s = 0, por_lote_s = 0, inicio;
+
+    if (!operaciones || !uno_a_uno || !por_lote) {
+        goto salir;
+    }
+    for (size_t i = 0; i < CANTIDAD / 2; i++) {
+        abb_guardar(uno_a_uno, claves + i * LARGO_CLAVE, NULL);
+        abb_guardar(por_lote, claves + i * LARGO_CLAVE, NULL);
+    }
+    for (size_t desde = CANTIDAD / 2; desde + TAM_LOTE <= CANTIDAD; desde += TAM_LOTE) {
+        for (size_t i = 0; i < TAM_LOTE; i++) {
+            operaciones[i].tipo = ABB_GUARDAR;
+            operaciones[i].clave = claves + (desde + i) * LARGO_CLAVE;
+            operaciones[i].dato = NULL;
+        }
+        qsort(operaciones, TAM_LOTE, sizeof(abb_operacion_t), comparar_operaciones);
+
+        inicio = ahora();
+        for (size_t i = 0; i < TAM_LOTE; i++) {
+            abb_guardar(uno_a_uno, operaciones[i].clave, operaciones[i].dato);
+        }
+        uno_a_uno_s += ahora() - inicio;
+        inicio = ahora();
+        abb_aplicar_lote(por_lote, operaciones, TAM_LOTE);
+        por_lote_s += ahora() - inicio;
+    }
+    printf("guardar uno a uno:   %8.0f claves/s\n", (CANTIDAD / 2) / uno_a_uno_s);
+    printf("aplicar lote (%d): %8.0f claves/s (%.2fx)\n", TAM_LOTE, (CANTIDAD / 2) / por_lote_s,
+           uno_a_uno_s / por_lote_s);
+
+salir:
+    abb_destruir(uno_a_uno);
+    abb_destruir(por_lote);
+    free(operaciones);
+}
+
+/* Compara abb_clonar con reconstruir el ABB guardando sus elementos en otro,
+ * en el mismo orden aleatorio en que se guardaron (en orden quedaría degenerado) */
+static void medir_clonar(abb_t *arbol, const char *claves)
+{
+    abb_t *copia = abb_crear(strcmp, NULL);
+    double inicio, reconstruir_s, clonar_s;
+
+    if (!copia) {
+        return;
+    }
+    inicio = ahora();
+    for (size_t i = 0; i < CANTIDAD; i++) {
+        const char *clave = claves + i * LARGO_CLAVE;
+        abb_guardar(copia, clave, (void *) clave);
+    }
+    reconstruir_s = ahora() - inicio;
+    abb_destruir(copia);
+
+    inicio = ahora();
+    copia = abb_clonar(arbol, NULL);
+    clonar_s = ahora() - inicio;
+    abb_destruir(copia);
+
+    printf("reconstruir guardando: %8.2f ms\n", reconstruir_s * 1e3);
+    printf("abb_clonar:            %8.2f ms (%.2fx)\n", clonar_s * 1e3, reconstruir_s / clonar_s);
+}
+
+/* Crea un ABB con CANTIDAD elementos cuyos datos hay que liberar */
+static abb_t *crear_con_datos(const char *claves)
+{
+    abb_t *arbol = abb_crear(strcmp, free);
+
+    for (size_t i = 0; arbol && i < CANTIDAD; i++) {
+        abb_guardar(arbol, claves + i * LARGO_CLAVE, malloc(LARGO_CLAVE));
+    }
+    return arbol;
+}
+
+/* Compara lo que tarda en volver abb_destruir con lo que tarda abb_destruir_diferido */
+static void medir_destruccion(const char *claves)
+{
+    abb_t *arbol = crear_con_datos(claves);
+    double inicio, directo_s, diferido_s, espera_s;
+
+    inicio = ahora();
+    abb_destruir(arbol);
+    directo_s = ahora() - inicio;
+
+    arbol = crear_con_datos(claves);
+    inicio = ahora();
+    abb_destruir_diferido(arbol);
+    diferido_s = ahora() - inicio;
+    inicio = ahora();
+    abb_esperar_destrucciones();
+    espera_s = ahora() - inicio;
+
+    printf("abb_destruir:           %8.2f ms\n", directo_s * 1e3);
+    printf("abb_destruir_diferido:  %8.2f ms (reclamo en segundo plano: %.2f ms)\n", diferido_s * 1e3, espera_s * 1e3);
+}
+
+/* Guarda todas las claves en un ABB en archivo y compara lo que tarda en
+ * reabrirlo con lo que tarda en reconstruirlo guardando */
+static void medir_archivo(const char *claves)
+{
+    char ruta[64], ruta_claves[80], ruta_datos[80];
+    abb_t *arbol;
+    double inicio, guardar_s, reabrir_s, reconstruir_s;
+
+    snprintf(ruta, sizeof(ruta), "/tmp/abb_bench_archivo_%d", (int) getpid());
+    snprintf(ruta_claves, sizeof(ruta_claves), "%s.claves", ruta);
+    snprintf(ruta_datos, sizeof(ruta_datos), "%s.datos", ruta);
+    unlink(ruta);
+    unlink(ruta_claves);
+    unlink(ruta_datos);
+    arbol = abb_abrir_archivo(ruta, strcmp, 0);
+    if (!arbol) {
+        return;
+    }
+    inicio = ahora();
+    for (size_t i = 0; i < CANTIDAD; i++) {
+        abb_guardar(arbol, claves + i * LARGO_CLAVE, NULL);
+    }
+    abb_archivo_sincronizar(arbol);
+    guardar_s = ahora() - inicio;
+    abb_destruir(arbol);
+
+    inicio = ahora();
+    arbol = abb_abrir_archivo(ruta, strcmp, 0);
+    reabrir_s = ahora() - inicio;
+    if (!arbol || abb_cantidad(arbol) != CANTIDAD) {
+        printf("error: el archivo no se reabrio entero\n");
+    }
+    abb_destruir(arbol);
+
+    arbol = abb_crear(strcmp, NULL);
+    inicio = ahora();
+    for (size_t i = 0; arbol && i < CANTIDAD; i++) {
+        abb_guardar(arbol, claves + i * LARGO_CLAVE, NULL);
+    }
+    reconstruir_s = ahora() - inicio;
+    abb_destruir(arbol);
+
+    printf("guardar en archivo:         %8.0f claves/s\n", CANTIDAD / guardar_s);
+    printf("reconstruir guardando:      %8.2f ms\n", reconstruir_s * 1e3);
+    printf("reabrir abb_abrir_archivo:  %8.2f ms (%.2fx)\n", reabrir_s * 1e3, reconstruir_s / reabrir_s);
+    unlink(ruta);
+    unlink(ruta_claves);
+    unlink(ruta_datos);
+}
+
+/* ******************************************************************
+ *                        PROGRAMA PRINCIPAL
+ * *****************************************************************/
+
+int main(void)
+{
+    char *claves = crear_claves();
+    abb_t *arbol = abb_crear(strcmp, NULL);
+
+    if (!claves || !arbol) {
+        return 1;
+    }
+    for (size_t i = 0; i < CANTIDAD; i++) {
+        abb_guardar(arbol, claves + i * LARGO_CLAVE, claves + i * LARGO_CLAVE);
+    }
+    printf("~~~ BENCHMARK ABB (%d elementos) ~~~\n", CANTIDAD);
+    medir_filtro(arbol, claves);
+    medir_congelado(arbol, claves);
+    medir_bitacora(claves);
+    medir_lote(claves);
+    medir_clonar(arbol, claves);
+    medir_destruccion(claves);
+    medir_archivo(claves);
+
+    abb_destruir(arbol);
+    free(claves);
+    return 0;
+}
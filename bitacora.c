@@ -0,0 +1,374 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bitacora.h"
+
+#define BUFFER_INICIAL 4096         // Capacidad inicial del buffer de registros
+#define BUFFER_MAXIMO (1 << 20)     // Pasado este tamaño el buffer se escribe aunque no se sincronice
+#define VENTANA_NS 2000000          // Tiempo máximo que un registro espera al resto de su lote
+#define COMPACTAR_MINIMO (64 << 10) // Por debajo de este tamaño no se compacta
+#define ENCABEZADO 13               // crc (4), largo de la clave (4), largo del dato (4), tipo (1)
+#define CON_VENCIMIENTO 0x80        // Marca en el tipo de los registros que llevan vencimiento
+
+/* Cada registro es un encabezado seguido de la clave con su '\0' y del dato.
+ * Si el tipo tiene la marca CON_VENCIMIENTO, entre el encabezado y la clave
+ * van los 8 bytes del vencimiento. El crc cubre todo el registro salvo el
+ * propio crc. */
+struct bitacora {
+    int fd;
+    char *ruta;
+    char *buffer;           // Registros todavía no escritos
+    size_t usado;
+    size_t capacidad;
+    size_t lote;
+    size_t pendientes;      // Registros todavía no sincronizados
+    struct timespec primero;// Momento en que se agregó el primer pendiente
+    size_t tamanio;         // Bytes del archivo, contando los del buffer
+    size_t tamanio_imagen;  // Bytes del archivo después de la última compactación
+    bool error;
+};
+
+/* *****************************************************************
+ *                    Funciones auxiliares                         *
+ * *****************************************************************/
+
+/* Calcula el crc32 (polinomio de IEEE) de los bytes dados */
+static uint32_t crc32(const unsigned char *bytes, size_t largo)
+{
+    static uint32_t tabla[256];
+    uint32_t crc = 0xFFFFFFFFu;
+
+    if (!tabla[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; j++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            tabla[i] = c;
+        }
+    }
+    for (size_t i = 0; i < largo; i++) {
+        crc = tabla[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/* Agranda el buffer para que entren al menos libre bytes más */
+static bool buffer_reservar(bitacora_t *bitacora, size_t libre)
+{
+    size_t capacidad = bitacora->capacidad;
+    char *buffer;
+
+    if (bitacora->usado + libre <= capacidad) {
+        return true;
+    }
+    while (capacidad < bitacora->usado + libre) {
+        capacidad *= 2;
+    }
+    buffer = realloc(bitacora->buffer, capacidad);
+    if (!buffer) {
+        return false;
+    }
+    bitacora->buffer = buffer;
+    bitacora->capacidad = capacidad;
+    return true;
+}
+
+/* Escribe el buffer completo al archivo, sin esperar a que llegue al disco.
+ * Una escritura interrumpida por una señal se reintenta. Si falla, en el
+ * buffer queda solo lo que no se llegó a escribir */
+static bool escribir(bitacora_t *bitacora)
+{
+    size_t escrito = 0;
+
+    while (escrito < bitacora->usado) {
+        ssize_t n = write(bitacora->fd, bitacora->buffer + escrito, bitacora->usado - escrito);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            memmove(bitacora->buffer, bitacora->buffer + escrito, bitacora->usado - escrito);
+            bitacora->usado -= escrito;
+            bitacora->error = true;
+            return false;
+        }
+        escrito += (size_t) n;
+    }
+    bitacora->usado = 0;
+    return true;
+}
+
+/* Devuelve true si el primer registro pendiente ya esperó toda la ventana */
+static bool vencio_ventana(const bitacora_t *bitacora)
+{
+    struct timespec ahora;
+    long long transcurrido;
+
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    transcurrido = (long long) (ahora.tv_sec - bitacora->primero.tv_sec) * 1000000000LL
+                   + (ahora.tv_nsec - bitacora->primero.tv_nsec);
+    return transcurrido >= VENTANA_NS;
+}
+
+/* Sincroniza el directorio del archivo, para que un rename sobreviva a una caída */
+static bool sincronizar_directorio(const char *ruta)
+{
+    const char *barra = strrchr(ruta, '/');
+    char *directorio = barra ? strndup(ruta, (size_t) (barra - ruta) + 1) : strdup(".");
+    int fd;
+    bool ok;
+
+    if (!directorio) {
+        return false;
+    }
+    fd = open(directorio, O_RDONLY);
+    free(directorio);
+    if (fd < 0) {
+        return false;
+    }
+    ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+/* Crea la bitácora sobre el archivo dado con las banderas de apertura recibidas */
+static bitacora_t *bitacora_crear(const char *ruta, int banderas, size_t lote)
+{
+    bitacora_t *bitacora = malloc(sizeof(bitacora_t));
+
+    if (!bitacora) {
+        return NULL;
+    }
+    bitacora->ruta = strdup(ruta);
+    bitacora->buffer = malloc(BUFFER_INICIAL);
+    bitacora->fd = open(ruta, banderas, 0644);
+    if (!bitacora->ruta || !bitacora->buffer || bitacora->fd < 0) {
+        if (bitacora->fd >= 0) {
+            close(bitacora->fd);
+        }
+        free(bitacora->ruta);
+        free(bitacora->buffer);
+        free(bitacora);
+        return NULL;
+    }
+    bitacora->usado = 0;
+    bitacora->capacidad = BUFFER_INICIAL;
+    bitacora->lote = lote;
+    bitacora->pendientes = 0;
+    bitacora->tamanio = 0;
+    bitacora->tamanio_imagen = 0;
+    bitacora->error = false;
+    return bitacora;
+}
+
+/* Libera la bitácora sin sincronizar */
+static void bitacora_liberar(bitacora_t *bitacora)
+{
+    close(bitacora->fd);
+    free(bitacora->ruta);
+    free(bitacora->buffer);
+    free(bitacora);
+}
+
+/* *****************************************************************
+ *                    Primitivas de la bitácora                    *
+ * *****************************************************************/
+
+bitacora_t *bitacora_abrir(const char *ruta, size_t lote)
+{
+    return bitacora_crear(ruta, O_RDWR | O_CREAT, lote);
+}
+
+bool bitacora_reproducir(bitacora_t *bitacora, bitacora_aplicar_t aplicar, void *extra)
+{
+    struct stat info;
+    unsigned char *contenido;
+    size_t largo, valido = 0;
+    bool ok = true;
+
+    if (fstat(bitacora->fd, &info) < 0) {
+        return false;
+    }
+    largo = (size_t) info.st_size;
+    contenido = malloc(largo + 1);
+    if (!contenido) {
+        return false;
+    }
+    for (size_t leido = 0; leido < largo; ) {
+        ssize_t n = pread(bitacora->fd, contenido + leido, largo - leido, (off_t) leido);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(contenido);
+            return false;
+        }
+        leido += (size_t) n;
+    }
+
+    /* Aplico registros mientras estén completos y su crc coincida */
+    while (ok && largo - valido >= ENCABEZADO) {
+        const unsigned char *registro = contenido + valido;
+        uint32_t crc, largo_clave, largo_dato;
+        uint64_t vencimiento = 0;
+        size_t cabeza = ENCABEZADO, total;
+
+        memcpy(&crc, registro, 4);
+        memcpy(&largo_clave, registro + 4, 4);
+        memcpy(&largo_dato, registro + 8, 4);
+        if (registro[12] & CON_VENCIMIENTO) {
+            cabeza += sizeof(uint64_t);
+        }
+        total = cabeza + (size_t) largo_clave + 1 + largo_dato;
+        if (total > largo - valido || crc != crc32(registro + 4, total - 4)
+            || registro[cabeza + largo_clave] != '\0') {
+            break;
+        }
+        if (cabeza > ENCABEZADO) {
+            memcpy(&vencimiento, registro + ENCABEZADO, sizeof(uint64_t));
+        }
+        ok = aplicar((char) (registro[12] & ~CON_VENCIMIENTO), (const char *) registro + cabeza, vencimiento,
+                     registro + cabeza + largo_clave + 1, largo_dato, extra);
+        valido += total;
+    }
+    free(contenido);
+
+    /* Descarto la cola que haya quedado a medio escribir */
+    if (valido < largo && ftruncate(bitacora->fd, (off_t) valido) < 0) {
+        return false;
+    }
+    if (lseek(bitacora->fd, (off_t) valido, SEEK_SET) < 0) {
+        return false;
+    }
+    bitacora->tamanio = valido;
+    bitacora->tamanio_imagen = valido;
+    return ok;
+}
+
+bool bitacora_registrar(bitacora_t *bitacora, char tipo, const char *clave, uint64_t vencimiento,
+                        const void *dato, abb_serializar_dato_t serializar)
+{
+    size_t largo_clave = strlen(clave);
+    size_t largo_dato = 0;
+    size_t inicio = bitacora->usado;
+    size_t cabeza = ENCABEZADO + (vencimiento ? sizeof(uint64_t) : 0);
+    uint32_t campo;
+    char *registro;
+
+    /* Si el registro no se puede agregar, la bitácora queda con error: quien
+     * ya modificó el ABB se entera al sincronizar */
+    if (largo_clave > UINT32_MAX || !buffer_reservar(bitacora, cabeza + largo_clave + 1)) {
+        bitacora->error = true;
+        return false;
+    }
+    if (serializar) {
+        size_t libre = bitacora->capacidad - inicio - cabeza - largo_clave - 1;
+        largo_dato = serializar(dato, bitacora->buffer + inicio + cabeza + largo_clave + 1, libre);
+        if (largo_dato > libre) {
+            /* No entraba: agrando el buffer y serializo de nuevo */
+            if (largo_dato > UINT32_MAX || !buffer_reservar(bitacora, cabeza + largo_clave + 1 + largo_dato)) {
+                bitacora->error = true;
+                return false;
+            }
+            serializar(dato, bitacora->buffer + inicio + cabeza + largo_clave + 1, largo_dato);
+        }
+    }
+    registro = bitacora->buffer + inicio;
+    campo = (uint32_t) largo_clave;
+    memcpy(registro + 4, &campo, 4);
+    campo = (uint32_t) largo_dato;
+    memcpy(registro + 8, &campo, 4);
+    registro[12] = vencimiento ? (char) (tipo | CON_VENCIMIENTO) : tipo;
+    if (vencimiento) {
+        memcpy(registro + ENCABEZADO, &vencimiento, sizeof(uint64_t));
+    }
+    memcpy(registro + cabeza, clave, largo_clave + 1);
+    campo = crc32((unsigned char *) registro + 4, cabeza - 4 + largo_clave + 1 + largo_dato);
+    memcpy(registro, &campo, 4);
+
+    bitacora->usado += cabeza + largo_clave + 1 + largo_dato;
+    bitacora->tamanio += cabeza + largo_clave + 1 + largo_dato;
+    if (!bitacora->pendientes++) {
+        clock_gettime(CLOCK_MONOTONIC, &bitacora->primero);
+    }
+
+    /* Commit en grupo: un solo fsync por lote. El registro ya está agregado,
+     * así que un error al bajarlo a disco solo lo informa bitacora_sincronizar */
+    if (bitacora->lote && (bitacora->pendientes >= bitacora->lote || vencio_ventana(bitacora))) {
+        bitacora_sincronizar(bitacora);
+    } else if (bitacora->usado >= BUFFER_MAXIMO) {
+        escribir(bitacora);
+    }
+    return true;
+}
+
+bool bitacora_sincronizar(bitacora_t *bitacora)
+{
+    if (bitacora->pendientes || bitacora->usado) {
+        if (escribir(bitacora) && fdatasync(bitacora->fd) < 0) {
+            bitacora->error = true;
+        }
+        bitacora->pendientes = 0;
+    }
+    return !bitacora->error;
+}
+
+bool bitacora_debe_compactar(const bitacora_t *bitacora)
+{
+    return bitacora->tamanio >= COMPACTAR_MINIMO && bitacora->tamanio >= 2 * bitacora->tamanio_imagen;
+}
+
+bool bitacora_compactar(bitacora_t *bitacora, bitacora_volcar_t volcar, void *extra)
+{
+    size_t largo = strlen(bitacora->ruta);
+    char *temporal = malloc(largo + sizeof(".tmp"));
+    bitacora_t *imagen;
+
+    if (!temporal || !bitacora_sincronizar(bitacora)) {
+        free(temporal);
+        return false;
+    }
+    memcpy(temporal, bitacora->ruta, largo);
+    memcpy(temporal + largo, ".tmp", sizeof(".tmp"));
+    imagen = bitacora_crear(temporal, O_RDWR | O_CREAT | O_TRUNC, 0);
+    if (!imagen) {
+        free(temporal);
+        return false;
+    }
+
+    /* La imagen tiene que estar entera en disco antes de reemplazar al archivo */
+    if (!volcar(imagen, extra) || !bitacora_sincronizar(imagen)
+        || rename(temporal, bitacora->ruta) < 0) {
+        bitacora_liberar(imagen);
+        unlink(temporal);
+        free(temporal);
+        return false;
+    }
+    free(temporal);
+    sincronizar_directorio(bitacora->ruta);
+
+    /* Me quedo con el descriptor de la imagen, que ahora es el archivo */
+    close(bitacora->fd);
+    bitacora->fd = imagen->fd;
+    bitacora->tamanio = imagen->tamanio;
+    bitacora->tamanio_imagen = imagen->tamanio;
+    imagen->fd = -1;
+    free(imagen->ruta);
+    free(imagen->buffer);
+    free(imagen);
+    return true;
+}
+
+void bitacora_cerrar(bitacora_t *bitacora)
+{
+    if (!bitacora) return;
+    bitacora_sincronizar(bitacora);
+    bitacora_liberar(bitacora);
+}
@@ -0,0 +1,77 @@
+#ifndef BITACORA_H
+#define BITACORA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "abb.h"
+
+/* *****************************************************************
+ *                DEFINICION DE LOS TIPOS DE DATOS
+ * *****************************************************************/
+
+/* Bitácora de escritura anticipada: un archivo al que solo se le agregan
+ * registros de guardar y borrar. Los registros se acumulan en memoria y se
+ * bajan a disco en grupo, con un solo fsync para todo el lote. */
+
+struct bitacora;  // Definición completa en bitacora.c.
+typedef struct bitacora bitacora_t;
+
+#define BITACORA_GUARDAR 'G'
+#define BITACORA_BORRAR 'B'
+
+// Función que aplica un registro leído de la bitácora. dato tiene largo bytes
+// y vencimiento es el que se registró, o 0 si no tiene.
+typedef bool (*bitacora_aplicar_t) (char tipo, const char *clave, uint64_t vencimiento, const void *dato,
+                                    size_t largo, void *extra);
+
+// Función que escribe todos los registros de una imagen nueva de la bitácora.
+typedef bool (*bitacora_volcar_t) (bitacora_t *imagen, void *extra);
+
+
+/* *****************************************************************
+ *                    PRIMITIVAS DE LA BITACORA
+ * *****************************************************************/
+
+// Abre la bitácora del archivo dado, creándolo si no existe. Se hace un fsync
+// cada vez que se juntan lote registros, o cuando pasa un tiempo breve desde
+// el primer registro pendiente. Con lote 0 solo se hace al sincronizar.
+// Post: devuelve la bitácora abierta, o NULL en caso de error.
+bitacora_t *bitacora_abrir(const char *ruta, size_t lote);
+
+// Lee todos los registros válidos del archivo y los aplica en orden. Si el
+// final del archivo quedó cortado o corrupto (por ejemplo, por una caída),
+// lo descarta.
+// Pre: la bitácora fue abierta y todavía no se registró nada.
+// Post: devuelve false si no se pudo leer o si aplicar devolvió false.
+bool bitacora_reproducir(bitacora_t *bitacora, bitacora_aplicar_t aplicar, void *extra);
+
+// Agrega un registro. Si serializar es NULL el registro no lleva dato. Si
+// vencimiento no es 0 se guarda con el registro, tal como se recibe.
+// Pre: la bitácora fue abierta.
+// Post: devuelve false si no se pudo agregar; el error queda guardado y lo
+// informa también bitacora_sincronizar. Un error al escribir o sincronizar
+// un registro ya agregado lo informa solo bitacora_sincronizar.
+bool bitacora_registrar(bitacora_t *bitacora, char tipo, const char *clave, uint64_t vencimiento,
+                        const void *dato, abb_serializar_dato_t serializar);
+
+// Escribe los registros pendientes y espera a que estén en disco.
+// Pre: la bitácora fue abierta.
+// Post: devuelve false si hubo algún error de escritura desde que se abrió.
+bool bitacora_sincronizar(bitacora_t *bitacora);
+
+// Devuelve true si el archivo creció lo suficiente como para compactarlo.
+// Pre: la bitácora fue abierta.
+bool bitacora_debe_compactar(const bitacora_t *bitacora);
+
+// Reemplaza el archivo por una imagen con los registros que escriba volcar.
+// El reemplazo es atómico: ante una caída queda el archivo viejo o el nuevo.
+// Pre: la bitácora fue abierta.
+// Post: devuelve false si no se pudo reemplazar; el archivo viejo sigue en uso.
+bool bitacora_compactar(bitacora_t *bitacora, bitacora_volcar_t volcar, void *extra);
+
+// Sincroniza y cierra la bitácora.
+// Post: la bitácora fue cerrada.
+void bitacora_cerrar(bitacora_t *bitacora);
+
+#endif // BITACORA_H
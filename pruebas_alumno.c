@@ -4,6 +4,10 @@
 #include <string.h>
 #include "abb.h"
 #include "testing.h"
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 /* Pruebas para un abb vacio */
 static void pruebas_abb_vacio()
@@ -346,6 +350,1335 @@ static void pruebas_abb_iter_interno()
     print_test("el abb fue destruido", true);
 }
 
+static void pruebas_abb_memoria_compacta()
+{
+    char clave[16];
+    size_t i;
+    bool ok = true;
+    abb_estadisticas_t est;
+    abb_iter_t *iter;
+    abb_t *abb = abb_crear(strcmp, NULL);
+
+    printf("INICIO DE PRUEBAS DE MEMORIA COMPACTA\n");
+    print_test("crear abb", abb != NULL);
+
+    /* Guardo 10000 claves cortas y miro cuánto ocupa cada una */
+    for (i = 0; i < 10000; i++) {
+        sprintf(clave, "clave%05zu", (i * 7919) % 10000);
+        ok &= abb_guardar(abb, clave, NULL);
+    }
+    print_test("se guardaron 10000 elementos", ok && abb_cantidad(abb) == 10000);
+    abb_estadisticas(abb, &est);
+    print_test("las estadisticas cuentan 10000 elementos", est.cantidad == 10000);
+    print_test("cada elemento ocupa menos de 64 bytes", est.bytes_totales / est.cantidad < 64);
+
+    /* Borro la mitad y guardo claves nuevas, reusando nodos y claves borradas */
+    for (i = 0; i < 10000; i += 2) {
+        sprintf(clave, "clave%05zu", i);
+        ok &= abb_borrar(abb, clave) == NULL && !abb_pertenece(abb, clave);
+    }
+    for (i = 0; i < 20000; i++) {
+        sprintf(clave, "otra%05zu", i);
+        ok &= abb_guardar(abb, clave, NULL);
+    }
+    print_test("se borraron 5000 y guardaron 20000", ok && abb_cantidad(abb) == 25000);
+    for (i = 1; i < 10000; i += 2) {
+        sprintf(clave, "clave%05zu", i);
+        ok &= abb_pertenece(abb, clave);
+    }
+    print_test("las claves que no se borraron siguen estando", ok);
+
+    /* Guardar con una clave que devolvió el iterador */
+    iter = abb_iter_in_crear(abb);
+    print_test("guardar con la clave del iterador", abb_guardar(abb, abb_iter_in_ver_actual(iter), &i));
+    abb_iter_in_destruir(iter);
+    print_test("obtener clave00001", abb_obtener(abb, "clave00001") == &i);
+
+    abb_destruir(abb);
+    print_test("el abb fue destruido", true);
+}
+
+/* Función auxiliar para las pruebas del ABB congelado: junta las claves recorridas */
+static bool juntar_clave(const char *clave, void *dato, void *extra)
+{
+    char *juntas = extra;
+
+    strcat(juntas, clave);
+    return strlen(juntas) < 6;
+}
+
+static void pruebas_abb_congelado()
+{
+    char * claves[] = {"h", "d", "l", "b", "f", "j", "n", "a", "c", "e", "g", "i", "k", "m", "o"};
+    char * ausentes[] = {"0", "aa", "bb", "ff", "z"};
+    int datos[15];
+    char juntas[32];
+    size_t n, i;
+    bool ok = true;
+    abb_congelado_t *congelado;
+    abb_t *abb;
+
+    printf("INICIO DE PRUEBAS DE ABB CONGELADO\n");
+
+    /* Congelo árboles de 0 a 15 elementos, para probar todas las formas del arreglo */
+    for (n = 0; n <= 15; n++) {
+        abb = abb_crear(strcmp, NULL);
+        for (i = 0; i < n; i++) {
+            abb_guardar(abb, claves[i], datos + i);
+        }
+        congelado = abb_congelar(abb);
+        ok &= congelado && abb_congelado_cantidad(congelado) == n;
+        for (i = 0; i < 15; i++) {
+            ok &= abb_congelado_pertenece(congelado, claves[i]) == (i < n);
+            ok &= abb_congelado_obtener(congelado, claves[i]) == (i < n ? datos + i : NULL);
+        }
+        for (i = 0; i < 5; i++) {
+            ok &= !abb_congelado_pertenece(congelado, ausentes[i]);
+        }
+        abb_congelado_destruir(congelado);
+        abb_destruir(abb);
+    }
+    print_test("congelar de 0 a 15 elementos, obtener y pertenece", ok);
+
+    abb = abb_crear(strcmp, NULL);
+    for (i = 0; i < 15; i++) {
+        abb_guardar(abb, claves[i], datos + i);
+    }
+    congelado = abb_congelar(abb);
+    abb_borrar(abb, "a");
+    print_test("el congelado no cambia al borrar del abb", abb_congelado_pertenece(congelado, "a"));
+
+    juntas[0] = '\0';
+    abb_congelado_in_order(congelado, juntar_clave, juntas);
+    print_test("in-order corta cuando visitar devuelve false", strcmp(juntas, "abcdef") == 0);
+    juntas[0] = '\0';
+    abb_congelado_rango(congelado, "bb", "e", juntar_clave, juntas);
+    print_test("rango entre bb y e", strcmp(juntas, "cde") == 0);
+    juntas[0] = '\0';
+    abb_congelado_rango(congelado, "m", NULL, juntar_clave, juntas);
+    print_test("rango desde m sin cota superior", strcmp(juntas, "mno") == 0);
+    juntas[0] = '\0';
+    abb_congelado_rango(congelado, "p", NULL, juntar_clave, juntas);
+    print_test("rango vacío", strcmp(juntas, "") == 0);
+
+    abb_congelado_destruir(congelado);
+    abb_destruir(abb);
+    print_test("el abb congelado fue destruido", true);
+}
+
+/* Funciones auxiliares para las pruebas de la bitácora: los datos son enteros en memoria dinámica */
+static size_t serializar_entero(const void *dato, void *buffer, size_t capacidad)
+{
+    if (capacidad >= sizeof(int)) {
+        memcpy(buffer, dato, sizeof(int));
+    }
+    return sizeof(int);
+}
+
+static void *deserializar_entero(const void *bytes, size_t largo)
+{
+    int *dato = malloc(sizeof(int));
+
+    if (dato && largo == sizeof(int)) {
+        memcpy(dato, bytes, sizeof(int));
+    }
+    return dato;
+}
+
+static int *entero_crear(int valor)
+{
+    int *dato = malloc(sizeof(int));
+
+    *dato = valor;
+    return dato;
+}
+
+/* En un proceso aparte, escribe en la bitácora con el archivo sin lugar para
+ * un registro entero y después con lugar. Devuelve un bit por cada prueba */
+static int bitacora_sin_lugar(const char *ruta)
+{
+    abb_t *abb = abb_crear(strcmp, free);
+    struct rlimit limite = {0, RLIM_INFINITY};
+    FILE *archivo;
+    int resultado = 0;
+
+    if (!abb_bitacora_abrir(abb, ruta, serializar_entero, deserializar_entero, 1)
+        || !abb_guardar(abb, "a", entero_crear(1)) || !abb_bitacora_sincronizar(abb)) {
+        return 0;
+    }
+    /* El registro de b se escribe a medias y la escritura falla */
+    archivo = fopen(ruta, "rb");
+    fseek(archivo, 0, SEEK_END);
+    limite.rlim_cur = (rlim_t) ftell(archivo) + 5;
+    fclose(archivo);
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limite);
+    if (abb_guardar(abb, "b", entero_crear(2)) && abb_pertenece(abb, "b")) {
+        resultado |= 1;
+    }
+    if (!abb_bitacora_sincronizar(abb)) {
+        resultado |= 2;
+    }
+    limite.rlim_cur = RLIM_INFINITY;
+    setrlimit(RLIMIT_FSIZE, &limite);
+    abb_guardar(abb, "c", entero_crear(3));
+    abb_destruir(abb);
+    return resultado;
+}
+
+/* Devuelve true si el archivo dado contiene la cadena, sin su '\0' */
+static bool archivo_contiene_cadena(const char *ruta, const char *cadena)
+{
+    FILE *archivo = fopen(ruta, "rb");
+    size_t largo = strlen(cadena), leido;
+    char *contenido = malloc(1 << 20);
+    bool encontrada = false;
+
+    if (archivo && contenido) {
+        leido = fread(contenido, 1, 1 << 20, archivo);
+        for (size_t i = 0; !encontrada && i + largo <= leido; i++) {
+            encontrada = memcmp(contenido + i, cadena, largo) == 0;
+        }
+    }
+    if (archivo) {
+        fclose(archivo);
+    }
+    free(contenido);
+    return encontrada;
+}
+
+static void pruebas_abb_bitacora()
+{
+    char ruta[64];
+    char clave[16];
+    int i;
+    bool ok = true;
+    int *dato;
+    FILE *archivo;
+    long tamanio;
+    pid_t hijo;
+    int estado;
+    abb_estadisticas_t estadisticas;
+    abb_t *abb = abb_crear(strcmp, free);
+
+    printf("INICIO DE PRUEBAS DE BITACORA\n");
+    snprintf(ruta, sizeof(ruta), "/tmp/abb_bitacora_%d", (int) getpid());
+    unlink(ruta);
+
+    print_test("abrir bitacora nueva", abb_bitacora_abrir(abb, ruta, serializar_entero, deserializar_entero, 16));
+    print_test("guardar a-1", abb_guardar(abb, "a", entero_crear(1)));
+    print_test("guardar b-2", abb_guardar(abb, "b", entero_crear(2)));
+    print_test("guardar c-3", abb_guardar(abb, "c", entero_crear(3)));
+    print_test("reemplazar b-20", abb_guardar(abb, "b", entero_crear(20)));
+    free(abb_borrar(abb, "a"));
+    print_test("sincronizar", abb_bitacora_sincronizar(abb));
+    abb_destruir(abb);
+
+    /* Reabro: el contenido se reconstruye a partir de la bitácora */
+    abb = abb_crear(strcmp, free);
+    print_test("reabrir bitacora", abb_bitacora_abrir(abb, ruta, serializar_entero, deserializar_entero, 16));
+    print_test("la cantidad de elementos es 2", abb_cantidad(abb) == 2);
+    print_test("NO pertenece a", !abb_pertenece(abb, "a"));
+    dato = abb_obtener(abb, "b");
+    print_test("obtener b es 20", dato && *dato == 20);
+    dato = abb_obtener(abb, "c");
+    print_test("obtener c es 3", dato && *dato == 3);
+    abb_destruir(abb);
+
+    /* Un registro cortado al final se descarta sin perder los anteriores */
+    archivo = fopen(ruta, "ab");
+    fwrite("basura", 1, 6, archivo);
+    fclose(archivo);
+    abb = abb_crear(strcmp, free);
+    print_test("reabrir con la cola corrupta", abb_bitacora_abrir(abb, ruta, serializar_entero, deserializar_entero, 16));
+    print_test("la cantidad de elementos sigue siendo 2", abb_cantidad(abb) == 2);
+
+    /* Muchos reemplazos de pocas claves hacen que la bitácora se compacte */
+    for (i = 0; i < 20000; i++) {
+        sprintf(clave, "clave%d", i % 10);
+        ok &= abb_guardar(abb, clave, entero_crear(i));
+    }
+    print_test("guardar 20000 veces 10 claves", ok && abb_bitacora_sincronizar(abb));
+    archivo = fopen(ruta, "rb");
+    fseek(archivo, 0, SEEK_END);
+    tamanio = ftell(archivo);
+    fclose(archivo);
+    print_test("la bitacora se compacto", tamanio < 128 * 1024);
+    abb_destruir(abb);
+
+    abb = abb_crear(strcmp, free);
+    print_test("reabrir despues de compactar", abb_bitacora_abrir(abb, ruta, serializar_entero, deserializar_entero, 16));
+    print_test("la cantidad de elementos es 12", abb_cantidad(abb) == 12);
+    dato = abb_obtener(abb, "clave9");
+    print_test("obtener clave9 es 19999", dato && *dato == 19999);
+    abb_destruir(abb);
+    unlink(ruta);
+
+    /* Un error de escritura después de agregar el registro no deshace el
+     * guardar, y lo escrito a medias no se repite al reintentar */
+    fflush(stdout);
+    hijo = fork();
+    if (hijo == 0) {
+        _exit(bitacora_sin_lugar(ruta));
+    }
+    waitpid(hijo, &estado, 0);
+    print_test("guardar con la bitacora sin lugar", WIFEXITED(estado) && (WEXITSTATUS(estado) & 1));
+    print_test("sincronizar informa el error", WIFEXITED(estado) && (WEXITSTATUS(estado) & 2));
+    abb = abb_crear(strcmp, free);
+    print_test("reabrir despues de quedarse sin lugar", abb_bitacora_abrir(abb, ruta, serializar_entero, deserializar_entero, 16));
+    dato = abb_obtener(abb, "b");
+    print_test("lo escrito a medias se completa", abb_cantidad(abb) == 3 && dato && *dato == 2);
+    abb_destruir(abb);
+    unlink(ruta);
+
+    /* Los vencimientos se registran: lo vencido no vuelve y lo vigente
+     * vuelve con su vencimiento */
+    abb = abb_crear(strcmp, free);
+    abb_bitacora_abrir(abb, ruta, serializar_entero, deserializar_entero, 16);
+    abb_guardar(abb, "vencido", entero_crear(1));
+    abb_guardar_con_ttl(abb, "vencido", entero_crear(2), 0);
+    abb_guardar_con_ttl(abb, "vigente", entero_crear(3), 3600000);
+    print_test("guardar con vencimiento y bitacora", abb_bitacora_sincronizar(abb));
+    abb_destruir(abb);
+    abb = abb_crear(strcmp, free);
+    print_test("reabrir con vencimientos", abb_bitacora_abrir(abb, ruta, serializar_entero, deserializar_entero, 16));
+    print_test("lo vencido no vuelve", abb_cantidad(abb) == 1 && !abb_pertenece(abb, "vencido"));
+    abb_estadisticas(abb, &estadisticas);
+    print_test("lo vigente vuelve con vencimiento", abb_pertenece(abb, "vigente") && estadisticas.bytes_vencimientos > 0);
+
+    /* La imagen de la bitácora no incluye lo que ya venció */
+    abb_guardar_con_ttl(abb, "caducado", entero_crear(4), 0);
+    for (i = 0; i < 20000; i++) {
+        sprintf(clave, "clave%d", i % 10);
+        abb_guardar(abb, clave, entero_crear(i));
+    }
+    abb_bitacora_sincronizar(abb);
+    print_test("la imagen no incluye lo vencido", !archivo_contiene_cadena(ruta, "caducado")
+               && archivo_contiene_cadena(ruta, "vigente"));
+    abb_destruir(abb);
+    unlink(ruta);
+    print_test("el abb fue destruido", true);
+}
+
+/* Función auxiliar para las pruebas del iterador por tandas: junta las claves
+ * y anota el tamaño de cada tanda. Corta después de la tanda de corte */
+typedef struct tandas {
+    char juntas[64];
+    size_t tamanios[8];
+    size_t cantidad;
+    size_t corte;
+} tandas_t;
+
+static bool juntar_tanda(abb_par_t *pares, size_t cantidad, void *extra)
+{
+    tandas_t *tandas = extra;
+
+    for (size_t i = 0; i < cantidad; i++) {
+        strcat(tandas->juntas, pares[i].clave);
+    }
+    tandas->tamanios[tandas->cantidad++] = cantidad;
+    return tandas->cantidad != tandas->corte;
+}
+
+static bool contar_tanda(abb_par_t *pares, size_t cantidad, void *extra)
+{
+    tandas_t *tandas = extra;
+
+    tandas->cantidad++;
+    return cantidad == 5 && strcmp(pares[0].clave, pares[4].clave) < 0;
+}
+
+static void pruebas_abb_in_order_lote()
+{
+    char * claves[] = {"h", "d", "l", "b", "f", "j", "a", "c", "e", "g", "i", "k"};
+    abb_par_t buffer[5];
+    tandas_t tandas = {"", {0}, 0, 0};
+    abb_t *abb = abb_crear(strcmp, NULL);
+
+    printf("INICIO DE PRUEBAS DE ITERADOR INTERNO POR TANDAS\n");
+    print_test("recorrer abb vacio", abb_in_order_lote(abb, buffer, 5, juntar_tanda, &tandas));
+    print_test("el abb vacio no tiene tandas", tandas.cantidad == 0);
+
+    for (size_t i = 0; i < 12; i++) {
+        abb_guardar(abb, claves[i], claves[i]);
+    }
+    print_test("recorrer 12 elementos de a 5", abb_in_order_lote(abb, buffer, 5, juntar_tanda, &tandas));
+    print_test("las claves estan en orden", strcmp(tandas.juntas, "abcdefghijkl") == 0);
+    print_test("hubo tres tandas de 5, 5 y 2", tandas.cantidad == 3 && tandas.tamanios[0] == 5
+               && tandas.tamanios[1] == 5 && tandas.tamanios[2] == 2);
+    print_test("los datos corresponden a las claves", strcmp(buffer[1].clave, buffer[1].dato) == 0);
+
+    tandas.juntas[0] = '\0';
+    tandas.cantidad = 0;
+    tandas.corte = 1;
+    abb_in_order_lote(abb, buffer, 5, juntar_tanda, &tandas);
+    print_test("corta cuando visitar devuelve false", tandas.cantidad == 1 && strcmp(tandas.juntas, "abcde") == 0);
+    abb_destruir(abb);
+
+    /* Guardo en orden descendente: el camino por la izquierda tiene 100 nodos */
+    abb = abb_crear(strcmp, NULL);
+    for (int i = 99; i >= 0; i--) {
+        char clave[8];
+        sprintf(clave, "%02d", i);
+        abb_guardar(abb, clave, NULL);
+    }
+    tandas.juntas[0] = '\0';
+    tandas.cantidad = 0;
+    tandas.corte = 0;
+    print_test("recorrer 100 elementos de a 5 en un abb degenerado", abb_in_order_lote(abb, buffer, 5, contar_tanda, &tandas));
+    print_test("hubo 20 tandas", tandas.cantidad == 20);
+
+    abb_destruir(abb);
+    print_test("el abb fue destruido", true);
+}
+
+static void pruebas_abb_prefijo()
+{
+    char * claves[] = {"casa", "auto", "casco", "cas", "ca", "cama", "dado", "casas", "barco", "cascada"};
+    char juntas[64] = "";
+    abb_iter_t *iter;
+    abb_t *abb = abb_crear(strcmp, NULL);
+
+    printf("INICIO DE PRUEBAS DE PREFIJOS\n");
+    iter = abb_iter_prefijo_crear(abb, "ca", 0);
+    print_test("iterador de prefijo en abb vacio al final", iter && abb_iter_in_al_final(iter));
+    abb_iter_in_destruir(iter);
+    print_test("contar prefijo en abb vacio es 0", abb_contar_prefijo(abb, "ca") == 0);
+
+    for (size_t i = 0; i < 10; i++) {
+        abb_guardar(abb, claves[i], NULL);
+    }
+    print_test("contar prefijo cas es 5", abb_contar_prefijo(abb, "cas") == 5);
+    print_test("contar prefijo ca es 7", abb_contar_prefijo(abb, "ca") == 7);
+    print_test("contar prefijo vacio es 10", abb_contar_prefijo(abb, "") == 10);
+    print_test("contar prefijo z es 0", abb_contar_prefijo(abb, "z") == 0);
+
+    iter = abb_iter_prefijo_crear(abb, "cas", 0);
+    while (!abb_iter_in_al_final(iter)) {
+        strcat(juntas, abb_iter_in_ver_actual(iter));
+        strcat(juntas, ",");
+        abb_iter_in_avanzar(iter);
+    }
+    print_test("las claves con prefijo cas en orden", strcmp(juntas, "cas,casa,casas,cascada,casco,") == 0);
+    print_test("avanzar al final es false", !abb_iter_in_avanzar(iter));
+    print_test("ver actual al final es NULL", !abb_iter_in_ver_actual(iter));
+    abb_iter_in_destruir(iter);
+
+    iter = abb_iter_prefijo_crear(abb, "ca", 2);
+    print_test("con limite 2 la primera es ca", strcmp(abb_iter_in_ver_actual(iter), "ca") == 0);
+    print_test("avanzo", abb_iter_in_avanzar(iter));
+    print_test("la segunda es cama", strcmp(abb_iter_in_ver_actual(iter), "cama") == 0);
+    print_test("avanzo", abb_iter_in_avanzar(iter));
+    print_test("con limite 2 termina despues de dos", abb_iter_in_al_final(iter));
+    abb_iter_in_destruir(iter);
+
+    iter = abb_iter_prefijo_crear(abb, "bb", 0);
+    print_test("prefijo sin claves esta al final", abb_iter_in_al_final(iter));
+    abb_iter_in_destruir(iter);
+
+    abb_destruir(abb);
+    print_test("el abb fue destruido", true);
+}
+
+/* Función auxiliar para las pruebas del modo caché: cuenta los datos destruidos */
+static int destruidos;
+
+static void contar_destruido(void *dato)
+{
+    destruidos++;
+}
+
+static void pruebas_abb_cache()
+{
+    char clave[16];
+    bool ok = true;
+    abb_estadisticas_t antes, despues;
+    abb_t *abb = abb_crear_cache(strcmp, contar_destruido, 100, 0);
+
+    printf("INICIO DE PRUEBAS DE MODO CACHE\n");
+    print_test("crear abb en modo cache", abb != NULL);
+
+    /* Guardo 1000 claves, usando siempre la clave "caliente" */
+    destruidos = 0;
+    abb_guardar(abb, "caliente", NULL);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(clave, "clave%04d", i);
+        ok &= abb_guardar(abb, clave, NULL);
+        ok &= abb_cantidad(abb) <= 100;
+        abb_obtener(abb, "caliente");
+        if (i == 499) {
+            abb_estadisticas(abb, &antes);
+        }
+    }
+    abb_estadisticas(abb, &despues);
+    print_test("la cantidad nunca supera 100", ok && abb_cantidad(abb) == 100);
+    print_test("se destruyeron los 901 desalojados", destruidos == 901);
+    print_test("la clave usada siempre no se desalojo", abb_pertenece(abb, "caliente"));
+    print_test("la ultima clave guardada sigue", abb_pertenece(abb, "clave0999"));
+    print_test("la primera clave fue desalojada", !abb_pertenece(abb, "clave0000"));
+    print_test("la memoria no crece", despues.bytes_totales == antes.bytes_totales);
+    print_test("reemplazar no desaloja", abb_guardar(abb, "clave0999", NULL) && destruidos == 902);
+    abb_destruir(abb);
+    print_test("destruir destruye los 100 restantes", destruidos == 1002);
+
+    /* Con límite de bytes */
+    abb = abb_crear_cache(strcmp, NULL, 0, 4096);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(clave, "clave%04d", i);
+        ok &= abb_guardar(abb, clave, NULL);
+    }
+    abb_estadisticas(abb, &despues);
+    print_test("con limite de bytes se guardan menos elementos", ok && abb_cantidad(abb) < 1000 && abb_cantidad(abb) > 50);
+    abb_destruir(abb);
+    print_test("el abb fue destruido", true);
+
+    /* Con todos los elementos marcados, el desalojo igual saca uno solo */
+    abb = abb_crear_cache(strcmp, contar_destruido, 1000, 0);
+    destruidos = 0;
+    for (int i = 0; i < 1000; i++) {
+        sprintf(clave, "clave%04d", i);
+        ok &= abb_guardar(abb, clave, NULL);
+        abb_obtener(abb, clave);
+    }
+    print_test("con todos marcados se desaloja uno", abb_guardar(abb, "nueva", NULL) && destruidos == 1);
+    print_test("el elemento nuevo no es el siguiente en irse",
+               abb_guardar(abb, "otra", NULL) && abb_pertenece(abb, "nueva") && destruidos == 2);
+    abb_destruir(abb);
+}
+
+static void pruebas_abb_ttl()
+{
+    char clave[16];
+    bool ok = true;
+    size_t expirados;
+    abb_estadisticas_t antes, despues;
+    abb_t *abb = abb_crear(strcmp, contar_destruido);
+
+    printf("INICIO DE PRUEBAS DE VENCIMIENTOS\n");
+    destruidos = 0;
+    print_test("expirar en abb vacio no saca nada", abb_expirar(abb, 10) == 0);
+    print_test("guardar a sin vencimiento", abb_guardar(abb, "a", NULL));
+    print_test("guardar b que vence en una hora", abb_guardar_con_ttl(abb, "b", &ok, 3600000));
+    print_test("guardar c que ya vencio", abb_guardar_con_ttl(abb, "c", &ok, 0));
+    print_test("pertenece a", abb_pertenece(abb, "a"));
+    print_test("obtener b", abb_obtener(abb, "b") == &ok);
+    print_test("NO pertenece c vencida", !abb_pertenece(abb, "c"));
+    print_test("obtener c vencida es NULL", abb_obtener(abb, "c") == NULL);
+    print_test("c sigue contando hasta expirar", abb_cantidad(abb) == 3);
+    print_test("expirar saca solo a c", abb_expirar(abb, 10) == 1 && destruidos == 1);
+    print_test("la cantidad de elementos es 2", abb_cantidad(abb) == 2);
+
+    /* Volver a guardar sin vencimiento deja viejo al vencimiento encolado */
+    print_test("guardar d que ya vencio", abb_guardar_con_ttl(abb, "d", NULL, 0));
+    print_test("guardar d sin vencimiento", abb_guardar(abb, "d", NULL) && destruidos == 2);
+    print_test("pertenece d", abb_pertenece(abb, "d"));
+    print_test("expirar no saca a d", abb_expirar(abb, 10) == 0 && abb_pertenece(abb, "d"));
+
+    /* Borrar un elemento vencido lo destruye y devuelve NULL */
+    abb_guardar_con_ttl(abb, "e", &ok, 0);
+    print_test("borrar e vencida es NULL", abb_borrar(abb, "e") == NULL && destruidos == 3);
+
+    /* Muchos vencidos: expirar avanza de a poco */
+    for (int i = 0; i < 1000; i++) {
+        sprintf(clave, "sesion%04d", i);
+        ok &= abb_guardar_con_ttl(abb, clave, NULL, 0);
+    }
+    print_test("guardar 1000 vencidos", ok && abb_cantidad(abb) == 1003);
+    expirados = abb_expirar(abb, 100);
+    print_test("expirar con trabajo 100 saca como mucho 100", expirados > 0 && expirados <= 100);
+    print_test("expirar el resto", expirados + abb_expirar(abb, 5000) == 1000);
+    print_test("quedan a, b y d", abb_cantidad(abb) == 3);
+
+    /* Reemplazar muchas veces el vencimiento no hace crecer la cola sin límite */
+    abb_estadisticas(abb, &antes);
+    for (int i = 0; i < 10000; i++) {
+        ok &= abb_guardar_con_ttl(abb, "b", NULL, 3600000);
+    }
+    abb_estadisticas(abb, &despues);
+    print_test("la cola de vencimientos no crece sin limite", ok && despues.bytes_vencimientos <= antes.bytes_vencimientos);
+
+    abb_destruir(abb);
+    print_test("el abb fue destruido", true);
+}
+
+/* Función auxiliar para las pruebas del lote y del filtro: strcmp que cuenta las comparaciones */
+static size_t comparaciones;
+
+static int contar_comparacion(const char *a, const char *b)
+{
+    comparaciones++;
+    return strcmp(a, b);
+}
+
+static void pruebas_abb_aplicar_lote()
+{
+    int datos[] = {1, 2, 3, 4, 5, 6};
+    abb_operacion_t primero[] = {
+        {ABB_GUARDAR, "b", datos + 0}, {ABB_GUARDAR, "d", datos + 1}, {ABB_GUARDAR, "f", datos + 2},
+        {ABB_BORRAR, "g", datos}, {ABB_GUARDAR, "h", datos + 3}, {ABB_GUARDAR, "j", datos + 4}
+    };
+    abb_operacion_t segundo[] = {
+        {ABB_GUARDAR, "a", datos + 5}, {ABB_BORRAR, "b", NULL}, {ABB_GUARDAR, "d", datos + 5},
+        {ABB_GUARDAR, "e", datos + 5}, {ABB_BORRAR, "h", NULL}, {ABB_BORRAR, "z", datos}
+    };
+    abb_operacion_t grande[1000], chico[1];
+    char claves[1000][8];
+    char juntas[64] = "";
+    bool ok = true;
+    size_t en_lote;
+    abb_iter_t *iter;
+    abb_t *abb = abb_crear(strcmp, NULL);
+    abb_t *orden;
+
+    printf("INICIO DE PRUEBAS DE LOTES\n");
+    print_test("aplicar lote vacio", abb_aplicar_lote(abb, primero, 0) && abb_cantidad(abb) == 0);
+    print_test("aplicar lote a abb vacio", abb_aplicar_lote(abb, primero, 6));
+    print_test("la cantidad de elementos es 5", abb_cantidad(abb) == 5);
+    print_test("borrar g que no estaba deja NULL", primero[3].dato == NULL);
+    print_test("obtener h", abb_obtener(abb, "h") == datos + 3);
+
+    print_test("aplicar lote mezclado", abb_aplicar_lote(abb, segundo, 6));
+    print_test("borrar b devuelve su dato", segundo[1].dato == datos + 0);
+    print_test("borrar h devuelve su dato", segundo[4].dato == datos + 3);
+    print_test("borrar z que no estaba deja NULL", segundo[5].dato == NULL);
+    print_test("d fue reemplazado", abb_obtener(abb, "d") == datos + 5);
+    print_test("la cantidad de elementos es 5", abb_cantidad(abb) == 5);
+    iter = abb_iter_in_crear(abb);
+    while (!abb_iter_in_al_final(iter)) {
+        strcat(juntas, abb_iter_in_ver_actual(iter));
+        abb_iter_in_avanzar(iter);
+    }
+    abb_iter_in_destruir(iter);
+    print_test("las claves quedan en orden", strcmp(juntas, "adefj") == 0);
+    abb_destruir(abb);
+
+    /* Un abb degenerado (guardado en orden) que recibe un lote grande */
+    abb = abb_crear(contar_comparacion, NULL);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(claves[i], "%04d", i);
+        if (i % 2) {
+            abb_guardar(abb, claves[i], NULL);
+        }
+        grande[i].tipo = i % 4 == 1 ? ABB_BORRAR : ABB_GUARDAR;
+        grande[i].clave = claves[i];
+        grande[i].dato = claves[i];
+    }
+    print_test("aplicar lote de 1000 sobre abb degenerado", abb_aplicar_lote(abb, grande, 1000));
+    print_test("la cantidad de elementos es 750", abb_cantidad(abb) == 750);
+    for (int i = 0; i < 1000; i++) {
+        ok &= abb_pertenece(abb, claves[i]) == (i % 4 != 1);
+        ok &= i % 4 == 1 || abb_obtener(abb, claves[i]) == claves[i];
+    }
+    print_test("todas las operaciones se aplicaron", ok);
+    comparaciones = 0;
+    abb_obtener(abb, "0999");
+    print_test("el lote rebalanceo el abb degenerado", comparaciones <= 20);
+    abb_destruir(abb);
+
+    /* Un lote chico que baja hasta el fondo de un abb degenerado también lo
+     * rebalancea, porque lo que cuenta es lo que se recorrió */
+    abb = abb_crear(contar_comparacion, NULL);
+    for (int i = 0; i < 1000; i++) {
+        abb_guardar(abb, claves[i], NULL);
+    }
+    strcpy(juntas, "1000");
+    chico[0] = (abb_operacion_t) { .tipo = ABB_GUARDAR, .clave = juntas };
+    print_test("aplicar lote de 1 sobre abb degenerado", abb_aplicar_lote(abb, chico, 1));
+    comparaciones = 0;
+    abb_obtener(abb, "0999");
+    print_test("el lote chico rebalanceo el abb degenerado", comparaciones <= 20);
+    abb_destruir(abb);
+
+    /* Sobre un abb al azar, el lote no compara más que guardar de a una */
+    abb = abb_crear(contar_comparacion, NULL);
+    orden = abb_crear(contar_comparacion, NULL);
+    for (int i = 0; i < 1000; i++) {
+        sprintf(claves[i], "%05u", (unsigned) (i * 2654435761u) % 100000);
+        abb_guardar(abb, claves[i], NULL);
+        abb_guardar(orden, claves[i], NULL);
+    }
+    for (int i = 0; i < 1000; i++) {
+        sprintf(claves[i], "%05d", i * 100 + 1);
+        grande[i] = (abb_operacion_t) { .tipo = i % 2 ? ABB_GUARDAR : ABB_BORRAR, .clave = claves[i] };
+    }
+    comparaciones = 0;
+    ok = abb_aplicar_lote(abb, grande, 1000);
+    en_lote = comparaciones;
+    comparaciones = 0;
+    for (int i = 0; i < 1000; i++) {
+        ok &= grande[i].tipo == ABB_BORRAR ? (abb_borrar(orden, claves[i]), true) : abb_guardar(orden, claves[i], NULL);
+    }
+    print_test("el lote compara menos que de a una", ok && en_lote < comparaciones);
+    abb_destruir(abb);
+    abb_destruir(orden);
+    print_test("el abb fue destruido", true);
+}
+
+static void pruebas_abb_indice()
+{
+    char claves[2000][8];
+    abb_estadisticas_t estadisticas;
+    abb_operacion_t operaciones[] = {{ABB_BORRAR, "0000", NULL}, {ABB_GUARDAR, "zz", NULL}};
+    bool ok = true;
+    abb_t *abb = abb_crear(strcmp, NULL);
+
+    printf("INICIO DE PRUEBAS DE INDICE DE HASH\n");
+    for (int i = 0; i < 2000; i++) {
+        sprintf(claves[i], "%04d", i);
+    }
+    for (int i = 0; i < 1000; i++) {
+        abb_guardar(abb, claves[i], claves[i]);
+    }
+    print_test("indexar abb con 1000 elementos", abb_indexar(abb));
+    print_test("indexar de nuevo no hace nada", abb_indexar(abb));
+    abb_estadisticas(abb, &estadisticas);
+    print_test("las estadisticas cuentan el indice", estadisticas.bytes_indice > 0);
+
+    /* Guardo el resto (el índice crece) y borro la mitad (corrimientos hacia atrás) */
+    for (int i = 1000; i < 2000; i++) {
+        abb_guardar(abb, claves[i], claves[i]);
+    }
+    for (int i = 0; i < 2000; i += 2) {
+        ok &= abb_borrar(abb, claves[i]) == claves[i];
+    }
+    print_test("borrar la mitad de las claves", ok);
+    for (int i = 0; i < 2000; i++) {
+        ok &= abb_pertenece(abb, claves[i]) == (i % 2 == 1);
+        ok &= abb_obtener(abb, claves[i]) == (i % 2 ? claves[i] : NULL);
+    }
+    print_test("el indice responde por todas las claves", ok);
+    print_test("obtener clave que es prefijo de otra es NULL", abb_obtener(abb, "000") == NULL);
+    print_test("obtener clave mas larga es NULL", abb_obtener(abb, "00011") == NULL);
+
+    operaciones[0].clave = claves[1];
+    print_test("aplicar lote con indice", abb_aplicar_lote(abb, operaciones, 2));
+    print_test("el borrado del lote sale del indice", !abb_pertenece(abb, claves[1]));
+    print_test("el guardado del lote entra al indice", abb_pertenece(abb, "zz"));
+    print_test("la cantidad de elementos es 1000", abb_cantidad(abb) == 1000);
+    abb_destruir(abb);
+
+    /* Un abb vacío también se puede indexar */
+    abb = abb_crear(strcmp, NULL);
+    print_test("indexar abb vacio", abb_indexar(abb));
+    print_test("obtener en abb vacio indexado es NULL", abb_obtener(abb, "a") == NULL);
+    print_test("guardar en abb vacio indexado", abb_guardar(abb, "a", claves[0]));
+    print_test("obtener a", abb_obtener(abb, "a") == claves[0]);
+    abb_destruir(abb);
+}
+
+static int64_t sumar(int64_t a, int64_t b)
+{
+    return a + b;
+}
+
+/* Se queda con el primero que no sea -1: es asociativa pero no conmutativa */
+static int64_t primero(int64_t a, int64_t b)
+{
+    return a != -1 ? a : b;
+}
+
+static int64_t valor_entero(const void *dato)
+{
+    return *(const int *) dato;
+}
+
+/* Calcula el agregado del rango [desde, hasta] de claves[0..n) recorriéndolo entero */
+static int64_t agregar_a_mano(const abb_agregado_t *agregado, bool *presentes, int *valores,
+                              int desde, int hasta)
+{
+    int64_t resultado = agregado->identidad;
+
+    for (int i = desde; i <= hasta; i++) {
+        if (presentes[i]) {
+            resultado = agregado->combinar(resultado, valores[i]);
+        }
+    }
+    return resultado;
+}
+
+static void pruebas_abb_agregado()
+{
+    abb_agregado_t suma = {0, sumar, valor_entero};
+    abb_agregado_t primero_en_orden = {-1, primero, valor_entero};
+    char claves[300][8];
+    int valores[300];
+    bool presentes[300] = {false};
+    abb_operacion_t operaciones[30];
+    abb_estadisticas_t estadisticas;
+    bool ok = true;
+    abb_t *abb = abb_crear_agregado(strcmp, NULL, &suma);
+    abb_t *orden = abb_crear_agregado(strcmp, NULL, &primero_en_orden);
+
+    printf("INICIO DE PRUEBAS DE AGREGADOS\n");
+    print_test("agregar rango en abb vacio es la identidad", abb_agregar_rango(abb, NULL, NULL) == 0);
+    for (int i = 0; i < 300; i++) {
+        sprintf(claves[i], "%03d", i);
+        valores[i] = i * 7 % 101;
+    }
+    /* Guardo en un orden que no es el de las claves */
+    for (int i = 0; i < 300; i++) {
+        int k = i * 37 % 300;
+        ok &= abb_guardar(abb, claves[k], &valores[k]) && abb_guardar(orden, claves[k], &valores[k]);
+        presentes[k] = true;
+    }
+    print_test("guardar 300 elementos", ok);
+    print_test("el total es la suma de todos", abb_agregar_rango(abb, NULL, NULL) == agregar_a_mano(&suma, presentes, valores, 0, 299));
+    print_test("el primero en orden es el de la menor clave", abb_agregar_rango(orden, NULL, NULL) == valores[0]);
+    print_test("rango vacio es la identidad", abb_agregar_rango(abb, "100", "099") == 0);
+    print_test("rango sin elementos es la identidad", abb_agregar_rango(abb, "5", "6") == 0);
+    print_test("rango de una clave", abb_agregar_rango(abb, "150", "150") == valores[150]);
+    print_test("cotas que no son claves", abb_agregar_rango(abb, "0995", "1005") == agregar_a_mano(&suma, presentes, valores, 100, 100));
+
+    /* Borro, reemplazo y aplico un lote, y comparo todos los rangos contra el cálculo a mano */
+    for (int i = 0; i < 300; i += 3) {
+        abb_borrar(abb, claves[i]);
+        abb_borrar(orden, claves[i]);
+        presentes[i] = false;
+    }
+    for (int i = 1; i < 300; i += 10) {
+        /* El ABB no se entera si el dato cambia: hay que volver a guardarlo */
+        valores[i] += 1000;
+        abb_guardar(abb, claves[i], &valores[i]);
+        abb_guardar(orden, claves[i], &valores[i]);
+        presentes[i] = true;
+    }
+    for (int i = 0; i < 30; i++) {
+        operaciones[i].tipo = i % 2 ? ABB_BORRAR : ABB_GUARDAR;
+        operaciones[i].clave = claves[i * 10];
+        operaciones[i].dato = &valores[i * 10];
+        presentes[i * 10] = i % 2 == 0;
+    }
+    ok = abb_aplicar_lote(abb, operaciones, 30);
+    for (int i = 0; i < 30; i++) {
+        operaciones[i].dato = &valores[i * 10];
+    }
+    ok &= abb_aplicar_lote(orden, operaciones, 30);
+    print_test("borrar, reemplazar y aplicar lote", ok);
+    for (int desde = 0; desde < 300; desde += 13) {
+        for (int hasta = desde; hasta < 300; hasta += 17) {
+            ok &= abb_agregar_rango(abb, claves[desde], claves[hasta]) == agregar_a_mano(&suma, presentes, valores, desde, hasta);
+            ok &= abb_agregar_rango(orden, claves[desde], claves[hasta]) == agregar_a_mano(&primero_en_orden, presentes, valores, desde, hasta);
+        }
+        ok &= abb_agregar_rango(abb, claves[desde], NULL) == agregar_a_mano(&suma, presentes, valores, desde, 299);
+        ok &= abb_agregar_rango(abb, NULL, claves[desde]) == agregar_a_mano(&suma, presentes, valores, 0, desde);
+        ok &= abb_agregar_rango(orden, claves[desde], NULL) == agregar_a_mano(&primero_en_orden, presentes, valores, desde, 299);
+    }
+    print_test("todos los rangos coinciden con el calculo a mano", ok);
+    abb_estadisticas(abb, &estadisticas);
+    print_test("las estadisticas cuentan los agregados", estadisticas.bytes_agregados > 0);
+    print_test("no se puede mantener un segundo agregado", !abb_mantener_agregado(abb, &suma));
+    abb_destruir(abb);
+    abb_destruir(orden);
+
+    /* El agregado se puede sumar después, incluso a una caché que ya tiene elementos */
+    abb = abb_crear_cache(strcmp, NULL, 100, 0);
+    for (int i = 0; i < 300; i++) {
+        valores[i] = i * 7 % 101;
+        presentes[i] = false;
+    }
+    for (int i = 0; i < 50; i++) {
+        int k = i * 37 % 300;
+        abb_guardar(abb, claves[k], &valores[k]);
+        presentes[k] = true;
+    }
+    print_test("mantener agregado en una cache con elementos", abb_mantener_agregado(abb, &suma));
+    print_test("el agregado incluye lo guardado antes", abb_agregar_rango(abb, NULL, NULL) == agregar_a_mano(&suma, presentes, valores, 0, 299));
+    /* Al pasarse del límite la caché desaloja, y el agregado tiene que seguirla */
+    for (int i = 50; i < 300; i++) {
+        int k = i * 37 % 300;
+        abb_guardar(abb, claves[k], &valores[k]);
+    }
+    ok = abb_cantidad(abb) == 100;
+    for (int i = 0; i < 300; i++) {
+        presentes[i] = abb_pertenece(abb, claves[i]);
+    }
+    for (int desde = 0; desde < 300; desde += 29) {
+        ok &= abb_agregar_rango(abb, claves[desde], NULL) == agregar_a_mano(&suma, presentes, valores, desde, 299);
+    }
+    print_test("el agregado sigue a los desalojos de la cache", ok);
+    abb_destruir(abb);
+}
+
+static void pruebas_abb_destruir_diferido()
+{
+    char clave[16];
+    abb_t *abb = abb_crear(strcmp, contar_destruido);
+    abb_t *otro = abb_crear(strcmp, contar_destruido);
+
+    printf("INICIO DE PRUEBAS DE DESTRUCCION DIFERIDA\n");
+    abb_esperar_destrucciones();
+    print_test("esperar sin destrucciones pendientes", true);
+
+    destruidos = 0;
+    for (int i = 0; i < 10000; i++) {
+        sprintf(clave, "%05d", i);
+        abb_guardar(abb, clave, NULL);
+        if (i % 2) {
+            abb_guardar(otro, clave, NULL);
+        }
+    }
+    /* Algunos nodos libres en el medio, que no tienen dato para destruir */
+    for (int i = 0; i < 10000; i += 7) {
+        sprintf(clave, "%05d", i);
+        abb_borrar(abb, clave);
+    }
+    abb_destruir_diferido(abb);
+    abb_destruir_diferido(otro);
+    abb_destruir_diferido(NULL);
+    abb_esperar_destrucciones();
+    print_test("se destruyeron los datos de los dos abb", destruidos == 10000 - 1429 + 5000);
+
+    /* Despues de esperar se puede volver a diferir */
+    destruidos = 0;
+    abb = abb_crear(strcmp, contar_destruido);
+    abb_guardar(abb, "a", NULL);
+    abb_destruir_diferido(abb);
+    abb_esperar_destrucciones();
+    print_test("diferir despues de esperar", destruidos == 1);
+}
+
+static void *copiar_entero(const void *dato)
+{
+    return entero_crear(*(const int *) dato);
+}
+
+/* Copia enteros hasta que se agotan las copias permitidas, y después falla */
+static int copias_restantes;
+
+static void *copiar_entero_limitado(const void *dato)
+{
+    if (copias_restantes == 0) {
+        return NULL;
+    }
+    copias_restantes--;
+    return copiar_entero(dato);
+}
+
+static void pruebas_abb_clonar()
+{
+    abb_agregado_t suma = {0, sumar, valor_entero};
+    char clave[16];
+    bool ok = true;
+    abb_t *abb = abb_crear_agregado(strcmp, free, &suma);
+    abb_t *clon;
+
+    printf("INICIO DE PRUEBAS DE CLONAR\n");
+    clon = abb_clonar(abb, copiar_entero);
+    print_test("clonar abb vacio", clon && abb_cantidad(clon) == 0);
+    print_test("guardar en el clon vacio", abb_guardar(clon, "a", entero_crear(1)));
+    print_test("el original sigue vacio", abb_cantidad(abb) == 0);
+    abb_destruir(clon);
+
+    for (int i = 0; i < 1000; i++) {
+        sprintf(clave, "%04d", i * 7 % 1000);
+        abb_guardar(abb, clave, entero_crear(i * 7 % 1000));
+    }
+    for (int i = 0; i < 1000; i += 5) {
+        sprintf(clave, "%04d", i);
+        free(abb_borrar(abb, clave));
+    }
+    abb_indexar(abb);
+    clon = abb_clonar(abb, copiar_entero);
+    print_test("clonar abb con 800 elementos", clon && abb_cantidad(clon) == 800);
+    for (int i = 0; i < 1000; i++) {
+        int *dato;
+        sprintf(clave, "%04d", i);
+        dato = abb_obtener(clon, clave);
+        ok &= i % 5 ? dato && *dato == i && dato != abb_obtener(abb, clave) : dato == NULL;
+    }
+    print_test("el clon tiene copias de los mismos datos", ok);
+    print_test("el clon tiene los mismos agregados", abb_agregar_rango(clon, "0100", "0499") == abb_agregar_rango(abb, "0100", "0499"));
+
+    /* Los dos se modifican por separado; el clon reusa los nodos libres copiados */
+    free(abb_borrar(clon, "0001"));
+    abb_guardar(clon, "0000", entero_crear(0));
+    abb_guardar(clon, "zzzz", entero_crear(5));
+    print_test("borrar del clon no toca al original", abb_pertenece(abb, "0001") && !abb_pertenece(clon, "0001"));
+    print_test("guardar en el clon no toca al original", !abb_pertenece(abb, "zzzz") && !abb_pertenece(abb, "0000"));
+    print_test("el clon tiene 801 elementos", abb_cantidad(clon) == 801);
+    print_test("el original tiene 800 elementos", abb_cantidad(abb) == 800);
+    print_test("el agregado del clon refleja sus cambios",
+               abb_agregar_rango(clon, NULL, NULL) == abb_agregar_rango(abb, NULL, NULL) - 1 + 5);
+    /* Si una copia falla no queda clon, y las copias hechas se destruyen */
+    copias_restantes = 300;
+    print_test("clonar con una copia que falla devuelve NULL", !abb_clonar(abb, copiar_entero_limitado));
+    print_test("el original no se toca si la copia falla", abb_cantidad(abb) == 800 && *(int *) abb_obtener(abb, "0002") == 2);
+
+    /* Sin copiar_dato los datos se comparten y solo el original los destruye */
+    abb_destruir(clon);
+    clon = abb_clonar(abb, NULL);
+    print_test("clonar compartiendo los datos", clon && abb_obtener(clon, "0002") == abb_obtener(abb, "0002"));
+    print_test("reemplazar en el clon compartido", abb_guardar(clon, "0002", entero_crear(7)) && *(int *) abb_obtener(abb, "0002") == 2);
+    /* Lo guardado en el clon compartido no lo destruye nadie */
+    free(abb_borrar(clon, "0002"));
+    abb_borrar(clon, "0003");
+    print_test("borrar del clon compartido no destruye el dato", *(int *) abb_obtener(abb, "0003") == 3);
+    abb_destruir(clon);
+    print_test("el original sobrevive al clon compartido", *(int *) abb_obtener(abb, "0004") == 4);
+
+    clon = abb_clonar(abb, copiar_entero);
+    abb_destruir(abb);
+    print_test("el clon sobrevive al original", *(int *) abb_obtener(clon, "0002") == 2);
+    abb_destruir(clon);
+}
+
+static void pruebas_abb_filtro()
+{
+    char clave[16];
+    abb_estadisticas_t antes, despues;
+    size_t pasaron = 0;
+    bool ok = true;
+    abb_t *abb = abb_crear(contar_comparacion, NULL);
+    abb_t *clon;
+
+    printf("INICIO DE PRUEBAS DE FILTRO DE CLAVES AUSENTES\n");
+    abb_guardar(abb, "previa", NULL);
+    print_test("tasa de falsos positivos invalida", !abb_filtrar(abb, 100, 0) && !abb_filtrar(abb, 100, 1));
+    print_test("agregar filtro", abb_filtrar(abb, 1000, 0.01));
+    print_test("no se puede agregar dos veces", !abb_filtrar(abb, 1000, 0.01));
+    print_test("la clave previa pasa el filtro", abb_pertenece(abb, "previa"));
+    abb_estadisticas(abb, &antes);
+    print_test("las estadisticas cuentan el filtro", antes.bytes_filtro > 0);
+
+    /* Guardo más claves que la capacidad, así el filtro se rehace, y borro la mitad */
+    for (int i = 0; i < 4000; i++) {
+        sprintf(clave, "c%d", i);
+        ok &= abb_guardar(abb, clave, NULL);
+    }
+    for (int i = 0; i < 4000; i += 2) {
+        sprintf(clave, "c%d", i);
+        abb_borrar(abb, clave);
+    }
+    for (int i = 0; i < 4000; i++) {
+        sprintf(clave, "c%d", i);
+        ok &= abb_pertenece(abb, clave) == (i % 2 == 1);
+    }
+    print_test("sin falsos negativos despues de guardar y borrar", ok);
+    abb_estadisticas(abb, &despues);
+    print_test("el filtro crecio con el abb", despues.bytes_filtro > antes.bytes_filtro);
+
+    /* Una clave ausente que el filtro rechaza no llega a compararse */
+    for (int i = 0; i < 100000; i++) {
+        sprintf(clave, "ausente%d", i);
+        comparaciones = 0;
+        ok &= !abb_pertenece(abb, clave);
+        pasaron += comparaciones > 0;
+    }
+    print_test("las claves ausentes no pertenecen", ok);
+    print_test("pasan el filtro menos del 2% de las ausentes", pasaron < 2000);
+
+    clon = abb_clonar(abb, NULL);
+    print_test("el clon tiene el filtro", abb_pertenece(clon, "c1") && !abb_pertenece(clon, "c0"));
+    abb_destruir(clon);
+    abb_destruir(abb);
+}
+
+/* Devuelve true si cada clave "a<i>" con i < n pertenece al ABB en archivo
+ * exactamente cuando presente(i), con el dato i */
+static bool archivo_contiene(abb_t *abb, int n, bool (*presente)(int))
+{
+    char clave[16];
+    bool ok = true;
+
+    for (int i = 0; i < n; i++) {
+        int *dato;
+        sprintf(clave, "a%d", i);
+        dato = abb_obtener(abb, clave);
+        ok &= presente(i) ? dato && *dato == i : !dato;
+    }
+    return ok;
+}
+
+static bool impares(int i)
+{
+    return i % 2 == 1;
+}
+
+static bool impares_o_altos(int i)
+{
+    return i % 2 == 1 || i >= 5000;
+}
+
+/* Guarda las claves de desde a hasta, borrando cada vez la de 100 antes, así
+ * quedan vivas solo las últimas 100. Devuelve si todo salió bien */
+static bool archivo_rotar(abb_t *abb, int desde, int hasta)
+{
+    char clave[16];
+    bool ok = true;
+
+    for (int i = desde; i < hasta; i++) {
+        sprintf(clave, "c%d", i);
+        ok &= abb_guardar(abb, clave, &i);
+        if (i >= 100) {
+            int *dato;
+            sprintf(clave, "c%d", i - 100);
+            dato = abb_borrar(abb, clave);
+            ok &= dato && *dato == i - 100;
+        }
+    }
+    return ok;
+}
+
+/* Devuelve si el ABB tiene exactamente las 100 claves que deja archivo_rotar hasta hasta */
+static bool archivo_rotado(abb_t *abb, int hasta)
+{
+    char clave[16];
+    bool ok = abb_cantidad(abb) == 100;
+
+    for (int i = hasta - 100; i < hasta; i++) {
+        int *dato;
+        sprintf(clave, "c%d", i);
+        dato = abb_obtener(abb, clave);
+        ok &= dato && *dato == i;
+    }
+    return ok;
+}
+
+/* Para un hijo: con los archivos sin poder crecer, guarda hasta llenarlos,
+ * prueba un lote que no entra y borra hasta que un borrado falla por falta de
+ * lugar. Devuelve un bit por cada comprobación que salió bien */
+static int archivo_sin_lugar(const char *ruta)
+{
+    abb_t *abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    abb_operacion_t operaciones[1000];
+    char claves[1000][16], clave[16];
+    struct rlimit limite = {0, 0};
+    size_t cantidad;
+    int resultado = 0, i = 1;
+
+    if (!abb) {
+        return 0;
+    }
+    /* Ningún archivo puede crecer: agrandarlos falla en vez de matar al proceso */
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limite);
+    /* Con claves cortas se acaban los nodos antes que el lugar de las claves */
+    do {
+        sprintf(clave, "l%x", i++);
+    } while (i < 1000000 && abb_guardar(abb, clave, &i));
+    cantidad = abb_cantidad(abb);
+    for (int k = 0; k < 1000; k++) {
+        sprintf(claves[k], k % 3 ? "nueva%d" : "a%d", k);
+        operaciones[k] = (abb_operacion_t) { .tipo = k % 3 ? ABB_GUARDAR : ABB_BORRAR, .clave = claves[k], .dato = &k };
+    }
+    if (!abb_aplicar_lote(abb, operaciones, 1000) && abb_cantidad(abb) == cantidad
+        && !abb_pertenece(abb, "nueva1") && abb_pertenece(abb, "a3")) {
+        resultado |= 1;
+    }
+    i = 1;
+    do {
+        sprintf(clave, "a%d", i);
+        i += 2;
+    } while (i < 20000 && abb_borrar(abb, clave));
+    if (abb_pertenece(abb, clave) && abb_borrar(abb, "no esta") == NULL) {
+        resultado |= 2;
+    }
+    if (!abb_archivo_sincronizar(abb)) {
+        resultado |= 4;
+    }
+    return resultado;
+}
+
+static void pruebas_abb_archivo()
+{
+    char ruta[64], ruta_claves[80], ruta_datos[80], clave[16];
+    abb_operacion_t operaciones[2];
+    int valor = 7;
+    int *dato;
+    pid_t hijo;
+    int estado;
+    bool ok = true;
+    abb_t *abb;
+    abb_estadisticas_t estadisticas;
+
+    printf("INICIO DE PRUEBAS DE ABB EN ARCHIVO\n");
+    snprintf(ruta, sizeof(ruta), "/tmp/abb_archivo_%d", (int) getpid());
+    snprintf(ruta_claves, sizeof(ruta_claves), "%s.claves", ruta);
+    snprintf(ruta_datos, sizeof(ruta_datos), "%s.datos", ruta);
+    unlink(ruta);
+    unlink(ruta_claves);
+    unlink(ruta_datos);
+
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("abrir archivo nuevo", abb && abb_cantidad(abb) == 0);
+    print_test("guardar copia el dato", abb_guardar(abb, "siete", &valor));
+    valor = 8;
+    dato = abb_obtener(abb, "siete");
+    print_test("el dato vive en el archivo", dato && *dato == 7);
+    print_test("reemplazar el dato", abb_guardar(abb, "siete", &valor) && *(int *) abb_obtener(abb, "siete") == 8);
+    print_test("en archivo no hay indice ni filtro", !abb_indexar(abb) && !abb_filtrar(abb, 100, 0.01));
+    print_test("en archivo no hay vencimientos", !abb_guardar_con_ttl(abb, "x", &valor, 10));
+    print_test("en archivo no se congela", abb_congelar(abb) == NULL);
+    print_test("en archivo no hay clon", !abb_clonar(abb, NULL));
+    abb_borrar(abb, "siete");
+
+    /* Miles de claves, así los archivos crecen varias veces */
+    for (int i = 0; i < 10000; i++) {
+        sprintf(clave, "a%d", i);
+        ok &= abb_guardar(abb, clave, &i);
+    }
+    print_test("guardar muchos elementos", ok && abb_cantidad(abb) == 10000);
+    for (int i = 0; i < 10000; i += 2) {
+        sprintf(clave, "a%d", i);
+        dato = abb_borrar(abb, clave);
+        ok &= dato && *dato == i;
+    }
+    print_test("borrar la mitad", ok && abb_cantidad(abb) == 5000);
+    print_test("sincronizar", abb_archivo_sincronizar(abb));
+    abb_destruir(abb);
+
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("reabrir archivo", abb && abb_cantidad(abb) == 5000);
+    print_test("reabierto tiene los elementos", archivo_contiene(abb, 10000, impares));
+    abb_destruir(abb);
+    print_test("con otro tam_dato no abre", !abb_abrir_archivo(ruta, strcmp, sizeof(long long)));
+
+    /* El hijo modifica después del punto de control y se cae sin cerrar */
+    fflush(stdout);
+    hijo = fork();
+    if (hijo == 0) {
+        abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+        for (int i = 0; abb && i < 10000; i += 2) {
+            sprintf(clave, "a%d", i);
+            abb_guardar(abb, clave, &i);
+        }
+        for (int i = 1; abb && i < 5000; i += 2) {
+            sprintf(clave, "a%d", i);
+            abb_borrar(abb, clave);
+        }
+        _exit(0);
+    }
+    waitpid(hijo, &estado, 0);
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("reabrir despues de una caida", abb && abb_cantidad(abb) == 5000);
+    print_test("vuelve al ultimo punto de control", archivo_contiene(abb, 10000, impares));
+
+    /* Los nodos que tomó el hijo vuelven a estar libres */
+    for (int i = 5000; i < 10000; i += 2) {
+        sprintf(clave, "a%d", i);
+        ok &= abb_guardar(abb, clave, &i);
+    }
+    operaciones[0] = (abb_operacion_t) { .tipo = ABB_GUARDAR, .clave = "lote", .dato = &valor };
+    operaciones[1] = (abb_operacion_t) { .tipo = ABB_BORRAR, .clave = "lote" };
+    print_test("aplicar lote en archivo", abb_aplicar_lote(abb, operaciones, 2) && *(int *) operaciones[1].dato == 8);
+    abb_destruir(abb);
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("reabrir despues de recuperar", ok && abb && abb_cantidad(abb) == 7500);
+    print_test("reabierto tiene los elementos nuevos", archivo_contiene(abb, 10000, impares_o_altos));
+    abb_destruir(abb);
+
+    /* Sin lugar en disco, el lote no aplica nada y el borrado que falla no
+     * se confunde con una clave que no está */
+    fflush(stdout);
+    hijo = fork();
+    if (hijo == 0) {
+        _exit(archivo_sin_lugar(ruta));
+    }
+    waitpid(hijo, &estado, 0);
+    print_test("lote sin lugar no aplica ninguna", WIFEXITED(estado) && (WEXITSTATUS(estado) & 1));
+    print_test("borrar sin lugar deja la clave", WIFEXITED(estado) && (WEXITSTATUS(estado) & 2));
+    print_test("sincronizar informa el borrado que fallo", WIFEXITED(estado) && (WEXITSTATUS(estado) & 4));
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("reabrir despues de quedarse sin lugar", abb && !abb_pertenece(abb, "nueva1"));
+    abb_destruir(abb);
+    unlink(ruta);
+    unlink(ruta_claves);
+    unlink(ruta_datos);
+
+    /* Con muchas altas y bajas y pocas claves vivas, el espacio de las
+     * borradas se reusa aunque nunca se sincronice */
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("rotar 200000 claves en archivo", abb && archivo_rotar(abb, 0, 200000));
+    print_test("quedan las ultimas 100", archivo_rotado(abb, 200000));
+    abb_estadisticas(abb, &estadisticas);
+    print_test("las claves borradas se reusan", estadisticas.bytes_claves <= (1 << 20));
+    abb_destruir(abb);
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("reabrir despues de rotar", abb && archivo_rotado(abb, 200000));
+    print_test("rotar despues de reabrir", archivo_rotar(abb, 200000, 250000) && archivo_rotado(abb, 250000));
+    abb_destruir(abb);
+
+    /* Después de una caída los espacios libres se rehacen con los huecos. El
+     * hijo modifica poco, así no llega a escribir un punto de control */
+    fflush(stdout);
+    hijo = fork();
+    if (hijo == 0) {
+        abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+        if (abb) {
+            archivo_rotar(abb, 250000, 250500);
+        }
+        _exit(0);
+    }
+    waitpid(hijo, &estado, 0);
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("reabrir despues de una caida al rotar", abb && archivo_rotado(abb, 250000));
+    ok = abb && archivo_rotar(abb, 250000, 400000);
+    print_test("rotar despues de una caida", ok && archivo_rotado(abb, 400000));
+    abb_estadisticas(abb, &estadisticas);
+    print_test("los huecos se reusan despues de una caida", estadisticas.bytes_claves <= (1 << 20));
+    abb_destruir(abb);
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    print_test("reabrir despues de rotar tras la caida", abb && archivo_rotado(abb, 400000));
+    abb_destruir(abb);
+    unlink(ruta);
+    unlink(ruta_claves);
+    unlink(ruta_datos);
+
+    /* Los datos van aparte de las claves: datos grandes no ocupan el arreglo de claves */
+    abb = abb_abrir_archivo(ruta, strcmp, 1024);
+    ok = abb != NULL;
+    for (int i = 0; ok && i < 1000; i++) {
+        char grande[1024];
+        memset(grande, i % 256, sizeof(grande));
+        sprintf(clave, "g%d", i);
+        ok &= abb_guardar(abb, clave, grande);
+    }
+    abb_estadisticas(abb, &estadisticas);
+    print_test("datos grandes en archivo", ok && estadisticas.bytes_claves < 1000 * 1024 && estadisticas.bytes_nodos >= 1000 * 1024);
+    abb_destruir(abb);
+    abb = abb_abrir_archivo(ruta, strcmp, 1024);
+    dato = abb ? abb_obtener(abb, "g700") : NULL;
+    print_test("reabrir con datos grandes", dato && ((unsigned char *) dato)[1023] == 700 % 256);
+    abb_destruir(abb);
+    unlink(ruta);
+    unlink(ruta_claves);
+    unlink(ruta_datos);
+
+    /* Caída con un ABB de un solo nodo sincronizado */
+    fflush(stdout);
+    hijo = fork();
+    if (hijo == 0) {
+        abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+        if (abb && abb_guardar(abb, "unico", &valor)) {
+            abb_archivo_sincronizar(abb);
+        }
+        _exit(0);
+    }
+    waitpid(hijo, &estado, 0);
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    dato = abb ? abb_obtener(abb, "unico") : NULL;
+    print_test("reabrir un solo nodo despues de una caida", abb && abb_cantidad(abb) == 1 && dato && *dato == valor);
+    abb_destruir(abb);
+    unlink(ruta);
+    unlink(ruta_claves);
+    unlink(ruta_datos);
+
+    /* Guardar con el dato de otra clave, que está en el archivo y se mueve al crecer */
+    abb = abb_abrir_archivo(ruta, strcmp, sizeof(int));
+    ok = abb && abb_guardar(abb, "a", &valor);
+    for (int i = 0; ok && i < 20000; i++) {
+        sprintf(clave, "c%d", i);
+        ok &= abb_guardar(abb, clave, abb_obtener(abb, "a"));
+    }
+    ok = ok && abb_guardar(abb, "a", abb_obtener(abb, "a"));
+    dato = abb ? abb_obtener(abb, "c19999") : NULL;
+    print_test("guardar un dato del propio archivo", ok && dato && *dato == valor && *(int *) abb_obtener(abb, "a") == valor);
+    abb_destruir(abb);
+    unlink(ruta);
+    unlink(ruta_claves);
+    unlink(ruta_datos);
+}
+
 void pruebas_abb_alumno()
 {
     pruebas_abb_vacio();
@@ -357,4 +1690,18 @@ void pruebas_abb_alumno()
     pruebas_abb_iter_externo_vacio();
     pruebas_abb_iter_externo_algunos_elementos();
     pruebas_abb_iter_interno();
+    pruebas_abb_memoria_compacta();
+    pruebas_abb_congelado();
+    pruebas_abb_bitacora();
+    pruebas_abb_in_order_lote();
+    pruebas_abb_prefijo();
+    pruebas_abb_cache();
+    pruebas_abb_ttl();
+    pruebas_abb_aplicar_lote();
+    pruebas_abb_indice();
+    pruebas_abb_agregado();
+    pruebas_abb_destruir_diferido();
+    pruebas_abb_clonar();
+    pruebas_abb_filtro();
+    pruebas_abb_archivo();
 }